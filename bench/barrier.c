@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gc.h"
+
+/* This program measures the cost of the write barrier. An array of old
+objects is built, and then pointers are stored into their cells over and
+over, plainly, with the GC_WRITE macro and by calling gc_write.
+*/
+
+#define OBJECTS 20000 /* # of objects written into */
+#define CELLS 8 /* # of pointer cells in each object */
+#define ROUNDS 500 /* # of passes over the objects */
+
+GCP objects; /* Global root holding the objects */
+
+/* The time in seconds is returned by the following function. */
+double now(void) {
+    struct timespec ts; /* Monotonic time */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+/* Each pass stores into every cell of every object a pointer to another
+object, using the store given by mode. The objects are visited with a
+stride so that the stores touch many cards.
+*/
+double run(int mode) {
+    int r, i, c; /* Round, object and cell */
+    GCP obj, value; /* Object written into and pointer stored */
+    double start = now(); /* Start of the run */
+
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < OBJECTS; i++) {
+            obj = (GCP) objects[(i * 7919) % OBJECTS];
+            value = (GCP) objects[(i + r) % OBJECTS];
+            for (c = 0; c < CELLS; c++) {
+                if (mode == 0) obj[c] = (GCWORD) value;
+                else if (mode == 1) GC_WRITE(obj, (GCP *) &obj[c], value);
+                else gc_write(obj, (GCP *) &obj[c], value);
+            }
+        }
+    return (now() - start);
+}
+
+int main() {
+    GCWORD base; /* Marks the base of the stack */
+    int i; /* Object index */
+    double plain, macro, call; /* Time for each kind of store */
+    double stores = (double) ROUNDS * OBJECTS * CELLS; /* # of stores in a run */
+
+    gcinit(64 << 20, &base, &objects, NULL);
+    objects = gcalloc(OBJECTS * sizeof(GCWORD), OBJECTS);
+    for (i = 0; i < OBJECTS; i++)
+        gc_write(objects, (GCP *) &objects[i], gcalloc((CELLS + 2) * sizeof(GCWORD), CELLS));
+    run(0);
+    plain = run(0);
+    macro = run(1);
+    call = run(2);
+    printf("stores per run: %.0f\n", stores);
+    printf("plain store:    %6.2f ns/store\n", plain / stores * 1e9);
+    printf("GC_WRITE:       %6.2f ns/store\n", macro / stores * 1e9);
+    printf("gc_write:       %6.2f ns/store\n", call / stores * 1e9);
+    return (0);
+}
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "gc.h"
+
+/* This program runs the standard garbage collector workloads, each in a
+child process of its own so that it starts with a fresh heap:
+  trees    GCBench: short lived binary trees of growing depth, built top
+           down and bottom up, beside a long lived tree and array.
+  mix      Short lived objects of random sizes, of which one in twenty
+           replaces an object in a long lived table.
+  churn    A list from which the oldest node is dropped as each new one is
+           added, so that every object lives for the same span.
+  large    A ring of large arrays, some of them pointing at others, which
+           are replaced one at a time among short lived objects.
+  server   Threads which each build a request, parse it, build a response
+           and keep some of the responses in a session cache.
+For each workload the allocation throughput, the # of collections, the
+time spent collecting, the longest and the 99th percentile pause, and the
+peak resident set size are reported. Workloads are named on the command
+line to run only those, -n <MB> gives the collector a nursery, and -i <us>
+collects the heap incrementally, in steps of up to that many microseconds,
+on pages of a system page.
+*/
+
+#define HEAPBYTES ((size_t) 64 << 20) /* Initial size of the heap */
+/* GCBench */
+#define LONGLIVEDDEPTH 16 /* Depth of the long lived tree */
+#define ARRAYSIZE 500000 /* # of doubles in the long lived array */
+#define MINTREEDEPTH 4 /* Depth of the smallest short lived trees */
+#define MAXTREEDEPTH 16 /* Depth of the largest short lived trees */
+/* Mix */
+#define MIXLIVE 100000 /* # of objects in the long lived table */
+#define MIXALLOCS 20000000 /* # of objects allocated */
+/* Churn */
+#define CHURNLENGTH 200000 /* # of nodes in the list */
+#define CHURNALLOCS 20000000 /* # of nodes allocated */
+/* Large */
+#define RINGSIZE 32 /* # of arrays in the ring */
+#define RINGALLOCS 10000 /* # of arrays allocated */
+#define RINGBYTES (1 << 20) /* Largest array */
+#define RINGGARBAGE 50 /* # of short lived objects after each array */
+/* Server */
+#define SERVERTHREADS 4 /* # of threads serving requests */
+#define REQUESTS 100000 /* # of requests served by each thread */
+#define SESSIONS 1024 /* # of responses in a thread's session cache */
+#define HEADERS 8 /* # of header lines in a request */
+
+GCP tree, /* Long lived tree */
+        array, /* Long lived array, or table of objects */
+        head, /* Oldest node of the churned list */
+        tail, /* Newest node of the churned list */
+        ring, /* Ring of large arrays */
+        caches[SERVERTHREADS]; /* Session cache of each server thread */
+long allocated; /* # of bytes allocated by the finished threads */
+_Thread_local long threadAllocated; /* # of bytes allocated by the calling thread */
+_Thread_local uint64_t seed = 88172645463325252ULL; /* State of the random numbers */
+pthread_mutex_t countLock = PTHREAD_MUTEX_INITIALIZER; /* Guards allocated */
+
+/* The time in seconds is returned by the following function. */
+double now(void) {
+    struct timespec ts; /* Monotonic time */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+/* A random number is returned by the following function. */
+uint64_t random_number(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed);
+}
+
+/* An object is allocated and counted by the following function. */
+GCP alloc(size_t bytes, int pointers) {
+    threadAllocated = threadAllocated + bytes;
+    return (gcalloc(bytes, pointers));
+}
+
+/* The bytes allocated by the calling thread are added to allocated by the
+following function. */
+void count_allocated(void) {
+    pthread_mutex_lock(&countLock);
+    allocated = allocated + threadAllocated;
+    threadAllocated = 0;
+    pthread_mutex_unlock(&countLock);
+}
+
+/* A GCBench node has two children and two integers. */
+GCP new_node(void) {
+    return (alloc(4 * sizeof(GCWORD), 2));
+}
+
+/* The # of nodes in a tree of the given depth is returned by the following
+function. */
+long tree_size(int depth) {
+    return ((1L << (depth + 1)) - 1);
+}
+
+/* The children of node are built top down, to the given depth, by the
+following function. */
+void populate(int depth, GCP node) {
+    if (depth <= 0) return;
+    depth = depth - 1;
+    GC_WRITE(node, (GCP *) &node[0], new_node());
+    GC_WRITE(node, (GCP *) &node[1], new_node());
+    populate(depth, (GCP) node[0]);
+    populate(depth, (GCP) node[1]);
+}
+
+/* A tree of the given depth is built bottom up by the following function. */
+GCP make_tree(int depth) {
+    GCP node, /* Root of the tree */
+            left, /* Left subtree */
+            right; /* Right subtree */
+
+    if (depth <= 0) return (new_node());
+    left = make_tree(depth - 1);
+    right = make_tree(depth - 1);
+    node = new_node();
+    node[0] = (GCWORD) left;
+    node[1] = (GCWORD) right;
+    return (node);
+}
+
+/* The GCBench workload is run by the following function. */
+void run_trees(void) {
+    int depth; /* Depth of the short lived trees */
+    long i, /* Tree count */
+            iterations; /* # of trees of the depth */
+    GCP temp; /* Short lived tree */
+    double *d; /* Long lived array */
+
+    tree = new_node();
+    populate(LONGLIVEDDEPTH, tree);
+    array = alloc(ARRAYSIZE * sizeof(double), 0);
+    d = (double *) array;
+    for (i = 0; i < ARRAYSIZE / 2; i++) d[i] = 1.0 / (i + 1);
+    for (depth = MINTREEDEPTH; depth <= MAXTREEDEPTH; depth = depth + 2) {
+        iterations = 2 * tree_size(MAXTREEDEPTH) / tree_size(depth);
+        for (i = 0; i < iterations; i++) {
+            temp = new_node();
+            populate(depth, temp);
+        }
+        for (i = 0; i < iterations; i++) temp = make_tree(depth);
+    }
+    if (tree == NULL || ((double *) array)[1000] != 1.0 / 1001) {
+        fprintf(stderr, "gcbench - Long lived data was lost\n");
+        exit(1);
+    }
+}
+
+/* The mix of long and short lived objects is run by the following
+function. */
+void run_mix(void) {
+    long i; /* Allocation count */
+    GCP obj; /* Object allocated */
+
+    array = alloc(MIXLIVE * sizeof(GCWORD), MIXLIVE);
+    for (i = 0; i < MIXALLOCS; i++) {
+        obj = alloc(16 + (random_number() % 15) * 16, 1);
+        obj[0] = (GCWORD) obj;
+        if (i % 20 == 0) GC_WRITE(array, (GCP *) &array[random_number() % MIXLIVE], obj);
+    }
+}
+
+/* The churned list is run by the following function. */
+void run_churn(void) {
+    long i; /* Allocation count */
+    GCP node; /* Node allocated */
+
+    head = tail = alloc(3 * sizeof(GCWORD), 1);
+    for (i = 1; i < CHURNALLOCS; i++) {
+        node = alloc(3 * sizeof(GCWORD), 1);
+        node[1] = i;
+        GC_WRITE(tail, (GCP *) &tail[0], node);
+        tail = node;
+        if (i >= CHURNLENGTH) head = (GCP) head[0];
+    }
+    if (tail[1] - head[1] != CHURNLENGTH - 1) {
+        fprintf(stderr, "gcbench - The churned list was broken\n");
+        exit(1);
+    }
+}
+
+/* The ring of large arrays is run by the following function. Every
+fourth array holds pointers, to the arrays of the ring which have none, so
+that the arrays which are live stay within the ring. */
+void run_large(void) {
+    long i, /* Array count */
+            k; /* Short lived object count */
+    size_t bytes; /* Size of the array */
+    int pointers; /* # of pointers in the array */
+    GCP obj; /* Array allocated */
+
+    ring = alloc(RINGSIZE * sizeof(GCWORD), RINGSIZE);
+    for (i = 0; i < RINGALLOCS; i++) {
+        bytes = (4096 + random_number() % RINGBYTES) & ~(size_t) 7;
+        pointers = i % 4 == 0 ? RINGSIZE : 0;
+        obj = alloc(bytes, pointers);
+        if (pointers != 0) {
+            for (k = 0; k < RINGSIZE; k++)
+                if (k % 4 != 0) GC_WRITE(obj, (GCP *) &obj[k], (GCP) ring[k]);
+        } else
+            memset(obj, (int) i, bytes);
+        GC_WRITE(ring, (GCP *) &ring[i % RINGSIZE], obj);
+        for (k = 0; k < RINGGARBAGE; k++) alloc(64, 1);
+    }
+}
+
+/* A string of the given # of bytes is allocated by the following
+function. */
+GCP new_string(size_t bytes) {
+    GCP s = alloc(bytes, 0); /* String allocated */
+
+    memset(s, 'x', bytes - 1);
+    ((char *) s)[bytes - 1] = 0;
+    return (s);
+}
+
+/* A server thread serves requests with the following function. A request
+holds its method, path, header list and body. A response holds the
+request, a header list, a body and a status. Objects may become old while
+the objects they point to are allocated, so those pointers are stored with
+GC_WRITE. */
+void *serve(void *arg) {
+    int t = (int) (intptr_t) arg; /* Thread index */
+    GCWORD base; /* Marks the base of the stack */
+    GCP request, /* Request being served */
+            response, /* Its response */
+            line; /* Header line */
+    long i, /* Request count */
+            k; /* Header count */
+
+    if (t != 0) gc_register_thread(&base);
+    caches[t] = alloc(SESSIONS * sizeof(GCWORD), SESSIONS);
+    for (i = 0; i < REQUESTS; i++) {
+        request = alloc(5 * sizeof(GCWORD), 4);
+        GC_WRITE(request, (GCP *) &request[0], new_string(8));
+        GC_WRITE(request, (GCP *) &request[1], new_string(64 + random_number() % 64));
+        for (k = 0; k < HEADERS; k++) {
+            line = alloc(3 * sizeof(GCWORD), 3);
+            line[2] = request[2];
+            GC_WRITE(line, (GCP *) &line[0], new_string(16));
+            GC_WRITE(line, (GCP *) &line[1], new_string(32 + random_number() % 32));
+            GC_WRITE(request, (GCP *) &request[2], line);
+        }
+        GC_WRITE(request, (GCP *) &request[3], new_string(256 + random_number() % 1024));
+        request[4] = i;
+        response = alloc(4 * sizeof(GCWORD), 3);
+        response[0] = (GCWORD) request;
+        response[3] = 200;
+        for (k = 0; k < HEADERS / 2; k++) {
+            line = alloc(3 * sizeof(GCWORD), 3);
+            line[1] = ((GCP) request[2])[1];
+            line[2] = response[1];
+            GC_WRITE(line, (GCP *) &line[0], new_string(16));
+            GC_WRITE(response, (GCP *) &response[1], line);
+        }
+        GC_WRITE(response, (GCP *) &response[2], new_string(512 + random_number() % 2048));
+        if (random_number() % 4 == 0)
+            GC_WRITE(caches[t], (GCP *) &caches[t][random_number() % SESSIONS], response);
+        if (i % 1000 == 0) gc_safepoint();
+    }
+    count_allocated();
+    if (t != 0) gc_unregister_thread();
+    return (NULL);
+}
+
+/* A thread is waited for by the following function, which is called
+through gc_blocking. */
+void *join(void *arg) {
+    pthread_join(*(pthread_t *) arg, NULL);
+    return (NULL);
+}
+
+/* The server workload is run by the following function. */
+void run_server(void) {
+    pthread_t threads[SERVERTHREADS]; /* Server threads */
+    int t; /* Thread index */
+
+    for (t = 1; t < SERVERTHREADS; t++)
+        pthread_create(&threads[t], NULL, serve, (void *) (intptr_t) t);
+    serve((void *) 0);
+    for (t = 1; t < SERVERTHREADS; t++) gc_blocking(join, &threads[t]);
+}
+
+/* Each workload is described by the following structure. */
+typedef struct WORKLOAD {
+    const char *name; /* Name given on the command line */
+    void (*run)(void); /* Function running it */
+} WORKLOAD;
+
+WORKLOAD workloads[] = {
+        {"trees",  run_trees},
+        {"mix",    run_mix},
+        {"churn",  run_churn},
+        {"large",  run_large},
+        {"server", run_server},
+};
+
+/* A workload is run and reported by the following function, in a child
+process. */
+void run(WORKLOAD *wl, size_t nursery, unsigned step) {
+    GCWORD base; /* Marks the base of the stack */
+    double start, /* Start of the workload */
+            took; /* Time taken */
+    struct gc_stats stats; /* What the collector did */
+    struct rusage usage; /* Peak resident set size */
+
+    if (step != 0) {
+        gcinit_paged(HEAPBYTES, (size_t) sysconf(_SC_PAGESIZE), &base, &tree, &array, &head,
+                     &tail, &ring, &caches[0], &caches[1], &caches[2], &caches[3], NULL);
+        gc_set_incremental(step);
+    } else
+        gcinit(HEAPBYTES, &base, &tree, &array, &head, &tail, &ring,
+               &caches[0], &caches[1], &caches[2], &caches[3], NULL);
+    if (nursery != 0) gc_set_nursery(nursery);
+    start = now();
+    wl->run();
+    took = now() - start;
+    count_allocated();
+    gc_get_stats(&stats);
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-8s %8.2f %10.0f %10.0f %6lu %10.1f %10.2f %10.2f %10.1f\n", wl->name, took,
+           allocated / 1e6, allocated / 1e6 / took, (unsigned long) stats.total.collections,
+           stats.total.pauseNanos / 1e6, gc_pause_percentile(100, NULL) / 1e6,
+           gc_pause_percentile(99, NULL) / 1e6, usage.ru_maxrss / 1024.0);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    size_t nursery = 0; /* Size of the nursery */
+    unsigned step = 0; /* Longest incremental step in microseconds */
+    unsigned i; /* Workload index */
+    int k, /* Argument index */
+            named = 0; /* Set when workloads are named */
+    pid_t child; /* Process running a workload */
+    int status, /* Exit status of the child */
+            failed = 0; /* Set when a child failed */
+
+    for (k = 1; k < argc; k++) {
+        if (strcmp(argv[k], "-n") == 0 && k + 1 < argc) {
+            nursery = (size_t) atol(argv[k + 1]) << 20;
+            argv[k] = argv[k + 1] = NULL;
+            k = k + 1;
+        } else if (strcmp(argv[k], "-i") == 0 && k + 1 < argc) {
+            step = (unsigned) atol(argv[k + 1]);
+            argv[k] = argv[k + 1] = NULL;
+            k = k + 1;
+        } else
+            named = 1;
+    }
+    printf("%-8s %8s %10s %10s %6s %10s %10s %10s %10s\n", "workload", "seconds", "MB alloc",
+           "MB/s", "GCs", "GC ms", "max ms", "p99 ms", "peak MB");
+    fflush(stdout);
+    for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        if (named) {
+            for (k = 1; k < argc; k++)
+                if (argv[k] != NULL && strcmp(argv[k], workloads[i].name) == 0) break;
+            if (k == argc) continue;
+        }
+        child = fork();
+        if (child == 0) {
+            run(&workloads[i], nursery, step);
+            exit(0);
+        }
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("%-8s %8s\n", workloads[i].name, "FAILED");
+            fflush(stdout);
+            failed = 1;
+        }
+    }
+    return (failed);
+}
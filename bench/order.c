@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "gc.h"
+
+/* This program compares copy orders by the speed of the program after a
+collection. For each order a child process builds a binary tree and a
+list, with short lived objects allocated between their nodes so that the
+nodes start out scattered, allocates enough more short lived objects to
+collect them several times, and then times walks of the tree, first child
+first, and of the list.
+*/
+
+#define HEAPBYTES ((size_t) 512 << 20) /* Size of the heap */
+#define TREEDEPTH 20 /* Depth of the tree */
+#define LISTLENGTH 2000000 /* # of nodes in the list */
+#define NODEWORDS 4 /* # of words in a node */
+#define GARBAGE 8 /* # of short lived objects between two nodes */
+#define ALLOCATIONS 20000000 /* # of short lived objects after building */
+#define WALKS 10 /* # of walks timed */
+
+GCP tree, /* Binary tree */
+        list; /* List */
+GCP junk; /* Last short lived object, kept in memory */
+
+/* The time in seconds is returned by the following function. */
+double now(void) {
+    struct timespec ts; /* Monotonic time */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+/* A node is allocated after some short lived objects by the following
+function. */
+GCP node(int pointers) {
+    int i; /* Short lived object count */
+
+    for (i = rand() % GARBAGE; i >= 0; i--) junk = gcalloc(2 * sizeof(GCWORD), 1);
+    return (gcalloc(NODEWORDS * sizeof(GCWORD), pointers));
+}
+
+/* A tree of the given depth is built by the following function. */
+GCP make_tree(int depth) {
+    GCP n; /* Root of the tree */
+
+    if (depth == 0) return (NULL);
+    n = node(2);
+    n[1] = (GCWORD) make_tree(depth - 1);
+    n[0] = (GCWORD) make_tree(depth - 1);
+    n[2] = depth;
+    return (n);
+}
+
+/* The tree is walked, first child first, by the following function. */
+long walk_tree(GCP n) {
+    long sum = 0; /* Sum of the values */
+
+    while (n != NULL) {
+        sum = sum + n[2] + walk_tree((GCP) n[1]);
+        n = (GCP) n[0];
+    }
+    return (sum);
+}
+
+/* The benchmark is run with the given copy order by the following
+function. */
+void run(int order) {
+    GCWORD base; /* Marks the base of the stack */
+    GCP n; /* Node of the list */
+    long i, /* Node or allocation count */
+            sum = 0; /* Sum of the values */
+    double start, /* Start of the walks */
+            treeTime, /* Time for the tree walks */
+            listTime; /* Time for the list walks */
+
+    gcinit(HEAPBYTES, &base, &tree, &list, &junk, NULL);
+    gc_set_order(order);
+    srand(1);
+    tree = make_tree(TREEDEPTH);
+    for (i = 0; i < LISTLENGTH; i++) {
+        n = node(1);
+        n[0] = (GCWORD) list;
+        n[1] = i;
+        list = n;
+    }
+    for (i = 0; i < ALLOCATIONS; i++) junk = gcalloc(2 * sizeof(GCWORD), 1);
+    start = now();
+    for (i = 0; i < WALKS; i++) sum = sum + walk_tree(tree);
+    treeTime = now() - start;
+    start = now();
+    for (i = 0; i < WALKS; i++)
+        for (n = list; n != NULL; n = (GCP) n[0]) sum = sum + n[1];
+    listTime = now() - start;
+    printf("%8s %12.2f %12.2f %20ld\n", order == GC_ORDER_DEPTH ? "depth" : "breadth",
+           treeTime / WALKS * 1e3, listTime / WALKS * 1e3, sum);
+    fflush(stdout);
+}
+
+int main() {
+    static int orders[] = {GC_ORDER_BREADTH, GC_ORDER_DEPTH}; /* Orders measured */
+    unsigned i; /* Order index */
+    pid_t child; /* Process running the benchmark */
+    int status, /* Exit status of the child */
+            failed = 0; /* Set when a child failed */
+
+    printf("%8s %12s %12s %20s\n", "order", "tree ms", "list ms", "checksum");
+    fflush(stdout);
+    for (i = 0; i < sizeof(orders) / sizeof(orders[0]); i++) {
+        child = fork();
+        if (child == 0) {
+            run(orders[i]);
+            exit(0);
+        }
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("%8s %12s\n", orders[i] == GC_ORDER_DEPTH ? "depth" : "breadth", "FAILED");
+            fflush(stdout);
+            failed = 1;
+        }
+    }
+    return (failed);
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "gc.h"
+
+/* This program compares page sizes. For each size a child process builds a
+long lived tree and then allocates short lived lists, timing every
+allocation. Allocations which take more than PAUSEUS microseconds are
+counted as collection pauses.
+*/
+
+#define HEAPBYTES ((size_t) 256 << 20) /* Size of the heap */
+#define TREEDEPTH 16 /* Depth of the long lived tree */
+#define ALLOCATIONS 20000000 /* # of short lived objects */
+#define LISTLENGTH 1000 /* # of objects in a short lived list */
+#define PAUSEUS 100 /* Shortest pause in microseconds */
+
+GCP tree, /* Long lived tree */
+        list; /* Short lived list */
+double longest, /* Longest allocation in seconds */
+        paused; /* Total time in pauses */
+long pauses; /* # of pauses */
+
+/* The time in seconds is returned by the following function. */
+double now(void) {
+    struct timespec ts; /* Monotonic time */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+/* An object is allocated and its allocation timed by the following
+function. */
+GCP timed_alloc(size_t bytes, int pointers) {
+    double start = now(), /* Start of the allocation */
+            took; /* Time taken */
+    GCP obj = gcalloc(bytes, pointers); /* Object allocated */
+
+    took = now() - start;
+    if (took > longest) longest = took;
+    if (took > PAUSEUS * 1e-6) {
+        pauses = pauses + 1;
+        paused = paused + took;
+    }
+    return (obj);
+}
+
+/* A tree of the given depth is built by the following function. */
+GCP make_tree(int depth) {
+    GCP node; /* Root of the tree */
+
+    if (depth == 0) return (NULL);
+    node = gcalloc(2 * sizeof(GCWORD), 2);
+    node[0] = (GCWORD) make_tree(depth - 1);
+    node[1] = (GCWORD) make_tree(depth - 1);
+    return (node);
+}
+
+/* The benchmark is run with the given page size by the following function. */
+void run(size_t page_bytes) {
+    GCWORD base; /* Marks the base of the stack */
+    GCP node; /* Object in the list */
+    long i; /* Allocation count */
+    double start; /* Start of the allocations */
+
+    gcinit_paged(HEAPBYTES, page_bytes, &base, &tree, &list, NULL);
+    tree = make_tree(TREEDEPTH);
+    start = now();
+    for (i = 0; i < ALLOCATIONS; i++) {
+        if (i % LISTLENGTH == 0) list = NULL;
+        node = timed_alloc(2 * sizeof(GCWORD), 1);
+        node[0] = (GCWORD) list;
+        list = node;
+    }
+    printf("%9zu %12.1f %10ld %12.3f %12.3f\n", page_bytes,
+           ALLOCATIONS / (now() - start) * 1e-6, pauses,
+           pauses ? paused / pauses * 1e3 : 0.0, longest * 1e3);
+    fflush(stdout);
+}
+
+int main() {
+    size_t page_bytes; /* Page size being measured */
+    pid_t child; /* Process running the benchmark */
+    int status, /* Exit status of the child */
+            failed = 0; /* Set when a child failed */
+
+    printf("%9s %12s %10s %12s %12s\n", "page", "Mallocs/s", "pauses", "pause ms", "max ms");
+    fflush(stdout);
+    for (page_bytes = 512; page_bytes <= 2 << 20; page_bytes = page_bytes * 4) {
+        child = fork();
+        if (child == 0) {
+            run(page_bytes);
+            exit(0);
+        }
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("%9zu %12s\n", page_bytes, "FAILED");
+            fflush(stdout);
+            failed = 1;
+        }
+    }
+    return (failed);
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "gc.h"
+
+/* This program compares prefetch depths for the sweep. For each depth a
+child process builds a large linked structure, a list whose nodes also
+point at random other nodes, so that the objects met by the sweep are
+scattered over the heap. It then allocates short lived objects, which
+collects the structure again and again, timing every allocation.
+Allocations which take more than PAUSEUS microseconds are counted as
+collection pauses, and their total time is reported. Cache misses over
+the run are read from the hardware counters when the system allows it.
+*/
+
+#define HEAPBYTES ((size_t) 512 << 20) /* Size of the heap */
+#define NODES 2000000 /* # of nodes in the structure */
+#define TABLEWORDS 1024 /* # of nodes in a table chunk */
+#define ALLOCATIONS 40000000 /* # of short lived objects */
+#define PAUSEUS 1000 /* Shortest pause in microseconds */
+
+GCP nodes, /* Linked structure */
+        table; /* Chunks of nodes while the structure is built */
+double paused, /* Total time in pauses */
+        longest; /* Longest pause */
+long pauses; /* # of pauses */
+
+/* The time in seconds is returned by the following function. */
+double now(void) {
+    struct timespec ts; /* Monotonic time */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+/* A hardware cache miss counter is opened by the following function, which
+returns -1 when there is none. */
+int open_misses(void) {
+    struct perf_event_attr pe; /* Counter description */
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_MISSES;
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    return ((int) syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0));
+}
+
+/* The linked structure is built by the following function. Nodes are
+first kept in a table of chunks, so that random nodes can be linked. */
+void build(void) {
+    GCP chunk, /* Chunk of the table */
+            node; /* Node being linked */
+    long i; /* Node index */
+
+    table = gcalloc((NODES / TABLEWORDS + 1) * sizeof(GCWORD), NODES / TABLEWORDS + 1);
+    for (i = 0; i < NODES; i++) {
+        if (i % TABLEWORDS == 0) {
+            chunk = gcalloc(TABLEWORDS * sizeof(GCWORD), TABLEWORDS);
+            table[i / TABLEWORDS] = (GCWORD) chunk;
+        }
+        chunk = (GCP) table[i / TABLEWORDS];
+        node = gcalloc(4 * sizeof(GCWORD), 2);
+        node[0] = (GCWORD) nodes;
+        node[2] = (GCWORD) i;
+        chunk[i % TABLEWORDS] = (GCWORD) node;
+        nodes = node;
+    }
+    for (i = 0; i < NODES; i++) {
+        node = (GCP) ((GCP) table[i / TABLEWORDS])[i % TABLEWORDS];
+        chunk = (GCP) table[rand() % (NODES / TABLEWORDS)];
+        node[1] = chunk[rand() % TABLEWORDS];
+    }
+    table = NULL;
+}
+
+/* The benchmark is run with the given prefetch depth by the following
+function. */
+void run(int depth) {
+    GCWORD base; /* Marks the base of the stack */
+    long i, /* Allocation count */
+            misses = -1; /* # of cache misses */
+    double start, /* Start of an allocation */
+            took; /* Time taken */
+    int fd; /* Cache miss counter */
+
+    gcinit(HEAPBYTES, &base, &nodes, &table, NULL);
+    gc_set_prefetch(depth);
+    gc_set_release(GC_RELEASE_NONE, 0);
+    build();
+    fd = open_misses();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    for (i = 0; i < ALLOCATIONS; i++) {
+        start = now();
+        gcalloc(2 * sizeof(GCWORD), 1);
+        took = now() - start;
+        if (took > longest) longest = took;
+        if (took > PAUSEUS * 1e-6) {
+            pauses = pauses + 1;
+            paused = paused + took;
+        }
+    }
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+    }
+    if (misses >= 0)
+        printf("%6d %10ld %12.1f %12.1f %14ld\n", depth, pauses, paused * 1e3, longest * 1e3, misses);
+    else
+        printf("%6d %10ld %12.1f %12.1f %14s\n", depth, pauses, paused * 1e3, longest * 1e3, "n/a");
+    fflush(stdout);
+}
+
+int main() {
+    static int depths[] = {0, 2, 4, 8, 16, 32}; /* Depths measured */
+    unsigned i; /* Depth index */
+    pid_t child; /* Process running the benchmark */
+    int status, /* Exit status of the child */
+            failed = 0; /* Set when a child failed */
+
+    printf("%6s %10s %12s %12s %14s\n", "depth", "pauses", "total ms", "max ms", "cache misses");
+    fflush(stdout);
+    for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        child = fork();
+        if (child == 0) {
+            run(depths[i]);
+            exit(0);
+        }
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("%6d %10s\n", depths[i], "FAILED");
+            fflush(stdout);
+            failed = 1;
+        }
+    }
+    return (failed);
+}
@@ -0,0 +1,3455 @@
+/* mmap flags such as MAP_ANONYMOUS are not in strict ISO C */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "gc.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* This module implements the mostly-copying garbage collector whose
+interface is described in gc.h.
+*/
+
+/* External definitions */
+
+/* Objects are laid out in units of header sized words. */
+#ifdef GC_COMPACT_HEADER
+typedef uint32_t GCHEADER;
+#else
+typedef uintptr_t GCHEADER;
+#endif
+
+/* Objects of largeWords words or more are not placed in the heap. Each is
+given its own mapping, which holds a card table for the object followed
+by the following structure, which ends with the object's header. The
+structure is found GC_LARGEBYTES before the object, and holds the size and
+the # of pointer cells of the object, which its header may be too narrow
+for. Large objects are marked with a space number rather than copied, and
+their mappings are returned to the system when they die. */
+typedef struct LARGE {
+    unsigned char *cards; /* Mark for each card of the object, used by GC_WRITE */
+    char *base; /* Start of the mapping */
+    size_t bytes; /* # of bytes in the mapping */
+    intptr_t numOfCards, /* # of cards in cards */
+            pointers; /* # of pointer cells in the object */
+    int space, /* Space number of the object */
+            grey, /* Set while an incremental collection has it to sweep */
+            guarded; /* Set while the object is protected from the program */
+} LARGE;
+
+/* Objects of up to MAXCLASSCELLS pointer sized cells may be allocated
+without a header, on pages which hold one size class: one class for each
+# of cells and # of pointers. Classes are numbered from 1 by CLASS_OF. An
+allocation buffer for a class is a run of pages, like a thread's buffer. */
+#define MAXCLASSCELLS 4
+#define NUMCLASSES (MAXCLASSCELLS * (MAXCLASSCELLS + 3) / 2)
+#define CLASS_OF(cells, ptrs) ((cells) * ((cells) + 1) / 2 + (ptrs))
+typedef struct CLASSBUFFER {
+    GCWORD *free, /* Next free slot */
+            *end, /* End of the slots on the page */
+            *scan; /* First unswept slot on a copy page */
+    intptr_t nextPage, /* Page # of the next page in the buffer */
+            pagesLeft; /* # of pages left in the buffer after the current one */
+} CLASSBUFFER;
+intptr_t classCells[NUMCLASSES + 1], /* # of cells in an object of each class */
+        classPtrs[NUMCLASSES + 1]; /* # of pointers in an object of each class */
+
+/* Each registered thread is described by the following structure. The
+allocation buffer is a run of OBJECT pages: objects are allocated on the
+current page until it is full, and then on the next page of the run.
+Objects without pointers are allocated from a second buffer, atomic, whose
+pages are never swept. A worker copies objects of a size class into the
+class buffers of its copy buffer. */
+typedef struct GCTHREAD {
+    GCHEADER *firstFreeWordInPage; /* Ptr to the first free word on the current page */
+    intptr_t numFreeWordsInCurrent, /* # words left on the current page */
+            nextBufferPage, /* Page # of the next page in the buffer */
+            pagesLeftInBuffer; /* # of pages left in the buffer after the current one */
+    GCWORD *stackbase, /* Base of the thread's stack */
+            *stacktop; /* Top of the stack while the thread is stopped */
+    pthread_t self; /* The thread */
+    struct gc_shadow *shadow; /* Its handles, NULL while it works in another heap */
+    int precise; /* Set when its stack is not examined */
+    struct GCTHREAD *next, /* Next registered thread */
+            *atomic; /* Buffer for objects without pointers */
+    CLASSBUFFER classes[NUMCLASSES + 1]; /* Buffers for the size classes */
+} GCTHREAD;
+_Thread_local GCTHREAD *thisThread; /* The calling thread in thisHeap */
+_Thread_local struct gc_shadow gcShadow; /* Handles of the calling thread */
+
+/* Each collector thread is described by the following structure. Its copy
+buffer is kept in the allocation buffer fields of copy. Regions of pages
+which still have to be swept are held in grey: the owner pushes and pops
+at the bottom, other workers steal from the top. The pointer cells of the
+objects being swept wait in pending while the objects they point to are
+prefetched, up to MAXPREFETCH of them. In depth first order, copies are
+swept from the top of stack, up to MAXSTACKED of them, rather than in the
+order they were made. */
+#define MAXPREFETCH 64
+#define MAXSTACKED 256
+typedef struct GCWORKER {
+    GCTHREAD copy, /* Copy buffer */
+            atomic; /* Copy buffer for objects without pointers */
+    GCHEADER *scan, /* First unswept word on the current copy page */
+            **grey; /* Deque of regions waiting to be swept */
+    intptr_t top, /* Index of the oldest region */
+            bottom, /* Index past the newest region */
+            size; /* # of entries allocated in grey */
+    pthread_mutex_t lock; /* Guards the deque */
+    pthread_t thread; /* Thread running the worker */
+    struct gc_heap *heap; /* Heap the worker collects */
+    GCWORD *pending[MAXPREFETCH]; /* Ring of pointer cells not yet moved */
+    int firstPending, /* Index of the oldest pending cell */
+            numPending, /* # of pending cells */
+            numStacked; /* # of copies on stack */
+    unsigned unsweptClasses; /* Bit set for each class with copies to sweep */
+    uint64_t copiedObjects, /* # of objects copied during the collection */
+            copiedBytes; /* # of bytes copied during the collection */
+    GCHEADER *stack[MAXSTACKED]; /* Copies waiting to be swept, newest last */
+} GCWORKER;
+_Thread_local GCWORKER *thisWorker; /* The calling collector thread */
+
+/* The roots are pointer cells outside the heap, such as the globals given
+to gcinit, held in a table of ranges of cells. An entry is found by its
+index, which gc_add_root returns and gc_remove_root takes, and the entries
+removed are kept on a list to be used again. */
+typedef struct GCROOT {
+    GCP *base; /* First cell of the range */
+    intptr_t count, /* # of cells in the range, 0 for a free entry */
+            next; /* Next free entry, or -1 */
+} GCROOT;
+
+/* The pause of each collection is counted in a histogram of fixed size.
+Pauses of less than PAUSESUB nanoseconds have a bucket each, and each
+power of two above is split into PAUSESUB buckets, so that a bucket is
+narrower than 1/PAUSESUB of the pauses it holds. The heap size and the
+surviving bytes of the pauses are added up in their bucket. */
+#define PAUSESUBBITS 5
+#define PAUSESUB (1 << PAUSESUBBITS)
+#define PAUSEBUCKETS ((64 - PAUSESUBBITS + 1) * PAUSESUB)
+
+/* Everything the collector knows of a heap is kept in the following
+structure. A program may make several heaps, each with its own pages,
+threads, workers and settings. A thread works in one heap at a time,
+thisHeap, and a function of the collector reaches the fields of the heap
+it works on through a pointer h, most often taken from thisHeap. */
+struct gc_heap {
+    /* The heap is also divided into cards of CARDBYTES bytes. A card is marked
+    by gc_write when a pointer is stored on it. */
+    struct gc_cards cards;
+    /* The heap consists of a contiguous set of pages of memory. */
+    intptr_t pageBytes; /* # of bytes in a page */
+    int pageShift; /* log2 of pageBytes */
+    intptr_t firstheappage, /* Page # of first heap page */
+            lastheappage, /* Page # of last heap page */
+            numOfHeapPages, /* # of pages in the heap */
+            numOfReservedPages, /* # of pages reserved for the heap to grow into */
+            maxHeapPages, /* Largest # of pages the heap may grow to */
+            numOfBufferPages, /* # of pages handed out as an allocation buffer */
+            numOfAllocatedPages, /* # of pages currently allocated for storage */
+            numOfOldPages, /* # of allocated pages in the old space */
+            nurseryPages, /* # of pages in the nursery, 0 without generations */
+            firstFreePage, /* First possible free page */
+            *pageQueue, /* Page pageQueue for each page */
+            queue_head, /* Head of list of pages */
+            queue_tail; /* Tail of list of pages */
+    int *space, /* Space number for each page */
+            *typeMapping, /* Type of object allocated on the page */
+            current_space, /* Current space number */
+            next_space, /* Next space number */
+            old_space; /* Space number of the old generation */
+    GCROOT *roots; /* Ranges of root cells */
+    intptr_t numOfRoots, /* # of entries used in roots, free or not */
+            sizeOfRoots, /* # of entries allocated in roots */
+            freeRoot; /* First free entry of roots, or -1 */
+    double survivalTarget, /* Largest part of the heap expected to survive */
+            overheadTarget; /* Part of the time to spend collecting, or 0 */
+    intptr_t collectPages, /* # of pages in use which starts a full collection */
+            livePages; /* # of pages in use after the last full collection */
+    uint64_t fullNanos; /* Time the last full collection ended */
+    /* Free pages are found with bitmaps holding a bit for each page, set when
+    the page is in use. Bits past the last heap page are always set. */
+    uint64_t *usedPages, /* Pages in any space */
+            *nextPages, /* Pages in the next space during a collection */
+            *oldPages, /* Pages in the old space */
+            *releasedPages, /* Free pages whose memory was given back to the system */
+            *avoidPages, /* Pages in use or released, avoided when possible */
+            *idlePages, /* Pages free and not allocated since the last release */
+            *atomicPages, /* Pages holding objects without pointers */
+            *forwardBits, /* Claimed and forwarded bits for each cell of a class page */
+            *startBits, /* Bit for each word of a pinned page which starts an object */
+            *pinBits; /* Bit for each word of a pinned page which starts a pinned object */
+    intptr_t numOfBitmapWords, /* # of words in each bitmap */
+            numOfReleasedPages; /* # of pages in releasedPages */
+    /* Idle pages are given back to the system as set by gc_set_release, after
+    each collection or from a background thread. */
+    int releaseAdvice, /* How pages are given back */
+            releaseBusy, /* Set while the background thread gives pages back */
+            releaseStarted; /* Set once the background thread runs */
+    unsigned releaseInterval; /* Milliseconds between background releases */
+    /* A hint pins only the object it points into. The page holding the object
+    is kept in place with the space number pinSpace until the collection ends,
+    while the other objects on it are moved or left to die. */
+    intptr_t *pinnedPages, /* Pages pinned by the collection, one entry for each page */
+            numOfPinnedPages; /* # of pages in pinnedPages */
+    int pinSpace; /* Space number of the pinned pages */
+    /* An incremental collection stops the threads for the flip, and then
+    sweeps in steps of up to incrementalNanos, taken when threads allocate
+    pages, until nothing is left. Between steps, the pages marked in greyPages,
+    which may hold unswept objects, and the large objects still to be swept
+    are protected, so that the threads, which only hold pointers to the next
+    space, never see a pointer to the old one: a thread which touches a
+    protected page stops in fault_handler while the page is swept. */
+    uint64_t *greyPages, /* Pages which may hold unswept objects */
+            *protectedPages, /* Pages protected from the program */
+            incrementalNanos; /* Longest step, or 0 to collect at once */
+    int incrementalCycle; /* Set from the flip to the end of an incremental collection */
+    intptr_t cycleBefore, /* # of pages allocated before the flip */
+            cycleLimit; /* # of pages allocated at which the collection is finished at once */
+    /* What collections did is counted in gcStats, read by gc_get_stats. */
+    struct gc_stats gcStats;
+    /* The pauses are counted in a histogram of PAUSEBUCKETS buckets. */
+    uint64_t pauseCounts[PAUSEBUCKETS], /* # of pauses in each bucket */
+            pauseHeapBytes[PAUSEBUCKETS], /* Sum of the heap sizes in each bucket */
+            pauseSurvivorBytes[PAUSEBUCKETS], /* Sum of the surviving bytes in each bucket */
+            numOfPauses, /* # of pauses recorded */
+            longestPause; /* Longest pause recorded */
+    LARGE **largeObjects; /* Large objects in order of address */
+    intptr_t numOfLargeObjects, /* # of large objects */
+            sizeOfLargeObjects, /* # of entries allocated in largeObjects */
+            largeWords, /* Smallest # of words in a large object */
+            largeBytesYoung, /* # of bytes of large objects since the last collection */
+            largeBytesFull; /* # of bytes of large objects since the last full collection */
+    int *classMapping; /* Size class of each page, 0 for objects with headers */
+    size_t classBytes; /* Objects of up to this size are allocated by size class */
+    GCTHREAD *threads; /* List of registered threads */
+    int numOfThreads, /* # of registered threads */
+            numOfStoppedThreads; /* # of threads stopped for the collector */
+    volatile int stopRequested; /* Set while the collector wants threads stopped */
+    /* gcLock guards page allocation, the thread list and the collector. */
+    pthread_mutex_t gcLock;
+    pthread_cond_t gcStopped, /* A thread stopped */
+            gcResumed, /* The collection finished */
+            releaseDone, /* releaseBusy was cleared */
+            releaseWake; /* The release settings changed */
+    pthread_t releaseThread; /* Thread giving back idle pages */
+    GCWORKER *workers; /* Collector threads, workers[0] runs in collect() */
+    int numOfWorkers, /* # of workers used by a collection */
+            numOfStartedWorkers, /* # of workers with a thread */
+            numOfBusyWorkers, /* # of helper workers still sweeping */
+            idleWorkers, /* # of workers which found nothing to sweep */
+            prefetchDepth, /* # of pointer cells moved behind the sweep */
+            copyOrder; /* Order in which copies are swept */
+    unsigned workGeneration; /* Incremented to start the helper workers */
+    /* pageLock guards page allocation and the page queue while the workers run,
+    workLock guards starting and finishing the helper workers. */
+    pthread_mutex_t pageLock,
+            workLock;
+    pthread_cond_t workStart, /* Helpers may sweep */
+            workDone; /* The last helper finished */
+    /* A stack word is a hint when it lies in the heap, from hintStart[0], or
+    between the first and the last large object, from hintStart[1]. Each range
+    is hintBytes long. */
+    uintptr_t hintStart[2], hintBytes[2];
+    struct gc_heap *next; /* Next heap made */
+};
+typedef struct gc_heap GCHEAP;
+_Thread_local GCHEAP *thisHeap; /* The heap the calling thread works in */
+_Thread_local struct gc_cards *gcCards; /* Card table of thisHeap, used by GC_WRITE */
+GCHEAP *heaps; /* List of heaps made, the heap of gcinit first */
+/* heapLock guards adding to the list of heaps and the fault handler. */
+pthread_mutex_t heapLock = PTHREAD_MUTEX_INITIALIZER;
+int faultHandlerSet; /* Set once fault_handler is installed */
+struct sigaction oldFaultAction; /* Action for the faults which are not the collector's */
+
+/* Page type definitions */
+#define OBJECT 0
+#define CONTINUED 1
+/* PAGEBYTES(h) is the number of bytes/page of heap h, a power of two from MINPAGEBYTES
+to MAXPAGEBYTES chosen by gcinit. Pages of HUGEPAGEBYTES or more are backed
+by huge pages. */
+#define PAGEBYTES(h) ((h)->pageBytes)
+#define MINPAGEBYTES 512
+#define MAXPAGEBYTES (2 * 1024 * 1024)
+#define HUGEPAGEBYTES (2 * 1024 * 1024)
+#define WORDBYTES (sizeof(GCHEADER))
+#define PAGEWORDS(h) (PAGEBYTES(h)/WORDBYTES)
+/* # of heap words in a pointer cell. Objects are a multiple of this size and
+each page starts with PAGEPAD filler words, so that the word following a
+header is always pointer aligned. */
+#define PTRWORDS (sizeof(GCWORD)/WORDBYTES)
+#define PAGEPAD (PTRWORDS - 1)
+/* STACKINC is the alignment of pointers on the stack, and STACKCLEAR the #
+of words cleared below a collector step */
+#define STACKINC (sizeof(GCWORD))
+#define STACKCLEAR 1024
+/* HEAPRESERVE is the address space reserved for the heap to grow into, and
+SURVIVAL and OVERHEAD the defaults of survivalTarget and overheadTarget */
+#define HEAPRESERVE (sizeof(void *) >= 8 ? (uintptr_t) 1 << 36 : (uintptr_t) 1 << 30)
+#define SURVIVAL 0.25
+#define OVERHEAD 0.05
+/* BUFFERBYTES is the largest # of bytes handed out as an allocation buffer,
+unless a single page is larger */
+#define BUFFERBYTES (16 * 512)
+/* Objects of more than MAXSMALLWORDS words are given their own run of pages */
+#define MAXSMALLWORDS(h) ((intptr_t) (PAGEWORDS(h) - PAGEPAD))
+/* MAXWORKERS is the largest # of collector threads */
+#define MAXWORKERS 256
+/* Shared counters are read without their lock by the following define */
+#define PEEK(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+/* CARDBYTES is the # of bytes covered by a card, and CARDBLOCK the # of
+cards examined at once when looking for marked cards */
+#define CARDBYTES ((uintptr_t) 1 << CARDSHIFT)
+#define CARDSPERPAGE(h) (PAGEBYTES(h)/CARDBYTES)
+#define CARDBLOCK 64
+_Static_assert(CARDBYTES <= MINPAGEBYTES, "a card must not span pages");
+/* Bitmap words are looked at BITMAPBLOCK at a time */
+#define BITMAPBLOCK 8
+/* The bit for a page is set by the following define */
+#define SET_PAGE_BIT(h, bits, page) ((bits)[((page) - (h)->firstheappage) >> 6] |= \
+        (uint64_t) 1 << (((page) - (h)->firstheappage) & 63))
+#define CLEAR_PAGE_BIT(h, bits, page) ((bits)[((page) - (h)->firstheappage) >> 6] &= \
+        ~((uint64_t) 1 << (((page) - (h)->firstheappage) & 63)))
+#define PAGE_BIT(h, bits, page) ((bits)[((page) - (h)->firstheappage) >> 6] >> (((page) - (h)->firstheappage) & 63) & 1)
+/* RELEASEPAGES is the most pages the background thread gives back at once */
+#define RELEASEPAGES(h) ((intptr_t) (1 << 20) / PAGEBYTES(h) + 1)
+/* STREAMBYTES is the size from which copies bypass the cache */
+#define STREAMBYTES (32 * 1024)
+/* LARGEBYTES is the default size from which objects are large */
+#define LARGEBYTES (64 * 1024)
+/* The structure of a large object is found by the following define */
+#define LARGE_of(cp) ((LARGE *) ((char *) (cp) - GC_LARGEBYTES))
+_Static_assert(sizeof(LARGE) + sizeof(GCHEADER) <= GC_LARGEBYTES, "LARGE overlaps the header");
+/* FORWARDWORDS is the # of words of forwardBits for a page */
+#define FORWARDWORDS(h) (PAGEBYTES(h) / sizeof(GCWORD) / 32)
+/* The bit of startBits and pinBits for the heap word at p is found by the
+following defines */
+#define MAP_INDEX(h, p) (((uintptr_t) (p) - (uintptr_t) PAGE_to_GCP(h, (h)->firstheappage)) / WORDBYTES)
+#define MAP_BIT(bits, i) ((bits)[(i) >> 6] >> ((i) & 63) & 1)
+/* Page number <--> pointer conversion is done by the following defines */
+#define PAGE_to_GCP(h, p) ((GCP) ((uintptr_t) (p) << (h)->pageShift))
+#define GCP_to_PAGE(h, p) ((intptr_t) ((uintptr_t) (p) >> (h)->pageShift))
+/* Pointers into the heap, as opposed to large objects, are told apart by
+the following define */
+#define IN_HEAP(h, p) ((uintptr_t) (GCP_to_PAGE(h, p) - (h)->firstheappage) < (uintptr_t) (h)->numOfHeapPages)
+
+/* Objects which are allocated in the heap have a one word header. The
+form of the header is:
+63            33 32             1 0
++---------------+----------------+-+
+| # ptrs in obj | # words in obj |1|
++---------------+----------------+-+
+|           user data              | <-- user data starts here. GCP
+                .                     ptrs come first
+                .
+                .
+|                                  |
++----------------------------------+
+
+With GC_COMPACT_HEADER (or on a 32-bit host) the header is 32 bits wide and
+the fields are split at bits 17 and 1 instead.
+The number of words in the object count INCLUDES one word for the header
+and INCLUDES the words occupied by pointers.
+When an object is forwarded, the header will be replaced by the pointer to
+the new object which will have bit 0 equal to 0. A compact header holds
+the heap offset of the new object divided by four instead.
+*/
+#define HEADER_PTRS_SHIFT (WORDBYTES * 8 / 2 + 1)
+#define HEADER_WORDS_MASK (((GCHEADER) 1 << (HEADER_PTRS_SHIFT - 1)) - 1)
+#define HEADER_PTRS_MASK (((GCHEADER) 1 << (WORDBYTES * 8 - HEADER_PTRS_SHIFT)) - 1)
+#define MAKE_HEADER(words, ptrs) ((GCHEADER) (ptrs)<<HEADER_PTRS_SHIFT | (GCHEADER) (words)<<1 | 1)
+#define FORWARDED(header) (((header) & 1) == 0) // Get the flag whether the object is forwarded.
+#define HEADER_PTRS(header) ((header)>>HEADER_PTRS_SHIFT & HEADER_PTRS_MASK) // Get the # of pointers from the header
+#define HEADER_WORDS(header) ((header)>>1 & HEADER_WORDS_MASK) // Get the size of the object from the header.
+#define HEADER_BYTES(header) (((header)>>1 & HEADER_WORDS_MASK)*WORDBYTES) // Get the entire header minus the FORWARDED flag.
+#define HEADER(cp) (((GCHEADER *) (cp))[-1]) // Get the header of the object at cp.
+#ifdef GC_COMPACT_HEADER
+#define FORWARD_HEADER(h, np) ((GCHEADER) (((char *) (np) - (char *) PAGE_to_GCP(h, (h)->firstheappage)) >> 2))
+#define FORWARDING_PTR(h, header) ((GCP) ((char *) PAGE_to_GCP(h, (h)->firstheappage) + ((uintptr_t) (header) << 2)))
+#define MAXHEAPBYTES ((uintptr_t) 1 << 34)
+#else
+#define FORWARD_HEADER(h, np) ((GCHEADER) (np))
+#define FORWARDING_PTR(h, header) ((GCP) (header))
+#define MAXHEAPBYTES (~(uintptr_t) 0 / 2)
+#endif
+/* Garbage collector */
+/* The first word from k up to n of a bitmap which differs from pattern is
+found by the following functions, which return n when there is none.
+*/
+intptr_t find_word_scalar(uint64_t *bits, intptr_t k, intptr_t n, uint64_t pattern) {
+    while (k < n && bits[k] == pattern) k = k + 1;
+    return (k);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+intptr_t find_word_avx2(uint64_t *bits, intptr_t k, intptr_t n, uint64_t pattern) {
+    __m256i p = _mm256_set1_epi64x((long long) pattern), /* Pattern in each lane */
+            eq; /* Lanes equal to the pattern */
+
+    while (k < n && (k & (BITMAPBLOCK - 1)) != 0) {
+        if (bits[k] != pattern) return (k);
+        k = k + 1;
+    }
+    for (; k < n; k = k + BITMAPBLOCK) {
+        eq = _mm256_and_si256(_mm256_cmpeq_epi64(_mm256_load_si256((__m256i *) (bits + k)), p),
+                              _mm256_cmpeq_epi64(_mm256_load_si256((__m256i *) (bits + k + 4)), p));
+        if (_mm256_movemask_epi8(eq) != -1) break;
+    }
+    while (k < n && bits[k] == pattern) k = k + 1;
+    return (k < n ? k : n);
+}
+#endif
+
+/* The search for bitmap words is chosen in gcinit for the processor. */
+intptr_t (*find_word)(uint64_t *bits, intptr_t k, intptr_t n, uint64_t pattern) = find_word_scalar;
+
+/* A bitmap with no pages in it is made by the following function. */
+void clear_bitmap(uint64_t *bits) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t i = h->numOfHeapPages; /* First bit past the heap */
+
+    memset(bits, 0, h->numOfBitmapWords * sizeof(uint64_t));
+    if (i & 63) bits[i >> 6] = ~(uint64_t) 0 << (i & 63);
+    for (i = (i + 63) >> 6; i < h->numOfBitmapWords; i++) bits[i] = ~(uint64_t) 0;
+}
+
+/* A run of pages is looked for in a bitmap by the following function, from
+bit i onwards. It returns the bit # of the first run of n free pages,
+or when buffer is set of the first free run of any length, and leaves the
+length of the run, up to n, in run. It returns -1 when there is none.
+Whole words of used or free pages are skipped by find_word.
+*/
+intptr_t free_run(uint64_t *bits, intptr_t i, intptr_t n, int buffer, intptr_t *run) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t k, /* Word index */
+            start, /* First bit of the run */
+            end; /* Bit past the run */
+    uint64_t w; /* Word being examined */
+
+    for (;;) {
+        /* Find a free page */
+        k = i >> 6;
+        if (k >= h->numOfBitmapWords) return (-1);
+        w = ~bits[k] & (~(uint64_t) 0 << (i & 63));
+        if (w == 0) {
+            k = find_word(bits, k + 1, h->numOfBitmapWords, ~(uint64_t) 0);
+            if (k >= h->numOfBitmapWords) return (-1);
+            w = ~bits[k];
+        }
+        start = (k << 6) + __builtin_ctzll(w);
+
+        /* Find the used page which ends its run */
+        w = bits[k] & (~(uint64_t) 0 << (start & 63));
+        if (w == 0) {
+            k = find_word(bits, k + 1, h->numOfBitmapWords, 0);
+            w = k < h->numOfBitmapWords ? bits[k] : 1;
+        }
+        end = (k << 6) + __builtin_ctzll(w);
+        if (end > h->numOfHeapPages) end = h->numOfHeapPages;
+        if (buffer || end - start >= n) {
+            *run = end - start < n ? end - start : n;
+            return (start);
+        }
+        i = end;
+    }
+}
+
+/* A page is added to the page queue by the following function. */
+void queue(intptr_t page) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    if (h->queue_head != 0)
+        h->pageQueue[h->queue_tail] = page;
+    else
+        h->queue_head = page;
+    h->pageQueue[page] = 0;
+    h->queue_tail = page;
+}
+
+intptr_t allocatepage(intptr_t numOfPages, GCTHREAD *buffer, int atomic);
+void grow_heap(intptr_t pages);
+void *map_table(size_t bytes);
+void sweep_cells(GCP pp, intptr_t ptrs, int prefetch);
+uint64_t clock_nanos(void);
+
+/* The words from cp on are made into free objects by the following
+function. A compact header cannot describe a whole large page, so the free
+space is split when it has to be, keeping the following header aligned.
+*/
+void fill_words(GCHEADER *cp, intptr_t words) {
+    intptr_t n; /* # of words in the next free object */
+
+    while (words != 0) {
+        n = words;
+        if ((GCHEADER) n > HEADER_WORDS_MASK) n = (intptr_t) (HEADER_WORDS_MASK & ~(PTRWORDS - 1));
+        *cp = MAKE_HEADER(n, 0);
+        cp = cp + n;
+        words = words - n;
+    }
+}
+
+/* The deque of worker w is made to hold at least n regions by the
+following function. It is mapped rather than taken from malloc, so that it
+may grow in the fault handler. The caller holds the worker's lock, or no
+worker is sweeping.
+*/
+void grow_grey(GCWORKER *w, intptr_t n) {
+    GCHEADER **grey; /* New deque */
+
+    if (n <= w->size) return;
+    grey = (GCHEADER **) map_table(n * sizeof(GCHEADER *));
+    if (w->grey != NULL) {
+        memcpy(grey, w->grey, w->bottom * sizeof(GCHEADER *));
+        munmap(w->grey, w->size * sizeof(GCHEADER *));
+    }
+    w->grey = grey;
+    w->size = n;
+}
+
+/* A region of a page which has to be swept is added to the bottom of a
+worker's deque by the following function.
+*/
+void push_grey(GCWORKER *w, GCHEADER *cp) {
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom == w->size) grow_grey(w, w->size ? w->size * 2 : 64);
+    w->grey[w->bottom] = cp;
+    __atomic_store_n(&w->bottom, w->bottom + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* A region is removed from a worker's deque by the following function,
+from the bottom by its owner and from the top by any other worker.
+*/
+GCHEADER *pop_grey(GCWORKER *w, int steal) {
+    GCHEADER *cp = NULL; /* Region taken */
+
+    if (PEEK(w->top) == PEEK(w->bottom)) return (NULL);
+    pthread_mutex_lock(&w->lock);
+    if (w->top != w->bottom) {
+        if (steal) {
+            cp = w->grey[w->top];
+            __atomic_store_n(&w->top, w->top + 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_store_n(&w->bottom, w->bottom - 1, __ATOMIC_RELAXED);
+            cp = w->grey[w->bottom];
+        }
+        if (w->top == w->bottom) {
+            __atomic_store_n(&w->top, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&w->bottom, 0, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return (cp);
+}
+
+#if defined(__x86_64__) || defined(__SSE2__)
+/* Bytes are copied with non-temporal stores by the following function,
+which is used for objects too large to be worth keeping in the cache.
+*/
+void copy_stream(char *to, const char *from, size_t bytes) {
+    size_t head = (size_t) (-(uintptr_t) to & 15); /* # of bytes before to is aligned */
+    __m128i a, b, c, d; /* Bytes being copied */
+
+    memcpy(to, from, head);
+    to = to + head;
+    from = from + head;
+    bytes = bytes - head;
+    for (; bytes >= 64; bytes = bytes - 64, to = to + 64, from = from + 64) {
+        a = _mm_loadu_si128((const __m128i *) from);
+        b = _mm_loadu_si128((const __m128i *) (from + 16));
+        c = _mm_loadu_si128((const __m128i *) (from + 32));
+        d = _mm_loadu_si128((const __m128i *) (from + 48));
+        _mm_stream_si128((__m128i *) to, a);
+        _mm_stream_si128((__m128i *) (to + 16), b);
+        _mm_stream_si128((__m128i *) (to + 32), c);
+        _mm_stream_si128((__m128i *) (to + 48), d);
+    }
+    memcpy(to, from, bytes);
+    _mm_sfence();
+}
+#endif
+
+/* The words of an object are copied by the following function, with
+non-temporal stores from STREAMBYTES on.
+*/
+void copy_words(GCHEADER *to, GCHEADER *from, intptr_t words) {
+    size_t bytes = (size_t) words * sizeof(GCHEADER); /* # of bytes to copy */
+
+#if defined(__x86_64__) || defined(__SSE2__)
+    if (bytes >= STREAMBYTES) {
+        copy_stream((char *) to, (const char *) from, bytes);
+        return;
+    }
+#endif
+    memcpy(to, from, bytes);
+}
+
+/* The n pages from page on are marked as holding unswept objects during an
+incremental collection by the following function.
+*/
+void grey_pages(intptr_t page, intptr_t n) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    if (!h->incrementalCycle) return;
+    for (; n > 0; n--, page++) SET_PAGE_BIT(h, h->greyPages, page);
+}
+
+/* The pages of the object or page of objects at page are marked as swept
+by the following function.
+*/
+void clear_grey(intptr_t page) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    do {
+        CLEAR_PAGE_BIT(h, h->greyPages, page);
+        page = page + 1;
+    } while (page <= h->lastheappage && h->typeMapping[page] == CONTINUED);
+}
+
+/* The protection of the object or page of objects at page is removed by
+the following function, so that the collector may touch it.
+*/
+void open_pages(intptr_t page) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    do {
+        if (PAGE_BIT(h, h->protectedPages, page)) {
+            CLEAR_PAGE_BIT(h, h->protectedPages, page);
+            mprotect(PAGE_to_GCP(h, page), PAGEBYTES(h), PROT_READ | PROT_WRITE);
+        }
+        page = page + 1;
+    } while (page <= h->lastheappage && h->typeMapping[page] == CONTINUED);
+}
+
+/* The protection of a large object is removed by the following function.
+Its card table and structure are never protected.
+*/
+void open_large(LARGE *lo) {
+    char *obj = (char *) lo + GC_LARGEBYTES; /* First word of the object */
+
+    if (!lo->guarded) return;
+    mprotect(obj, lo->base + lo->bytes - obj, PROT_READ | PROT_WRITE);
+    lo->guarded = 0;
+}
+
+/* Space for the copy of an object is allocated from the worker's copy
+buffer by the following function, or from its atomic buffer when the object
+has no pointers. When a new copy page is needed, the unswept part of the
+current one is left on the worker's deque.
+*/
+GCHEADER *copyalloc(GCWORKER *w, intptr_t words, int atomic) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCTHREAD *b = atomic ? &w->atomic : &w->copy; /* Copy buffer */
+    GCHEADER *cp; /* Space for the copy */
+    intptr_t page; /* First page allocated */
+
+    if (words > MAXSMALLWORDS(h)) {
+        pthread_mutex_lock(&h->pageLock);
+        page = allocatepage((words + PAGEPAD + PAGEWORDS(h) - 1) / PAGEWORDS(h), NULL, atomic);
+        pthread_mutex_unlock(&h->pageLock);
+        if (!atomic) grey_pages(page, (words + PAGEPAD + PAGEWORDS(h) - 1) / PAGEWORDS(h));
+        return ((GCHEADER *) PAGE_to_GCP(h, page) + PAGEPAD);
+    }
+    if (words > b->numFreeWordsInCurrent) {
+        if (!atomic && w->scan != b->firstFreeWordInPage)
+            push_grey(w, w->scan);
+        else if (!atomic && h->incrementalCycle && b->firstFreeWordInPage != NULL)
+            CLEAR_PAGE_BIT(h, h->greyPages, GCP_to_PAGE(h, b->firstFreeWordInPage - 1));
+        fill_words(b->firstFreeWordInPage, b->numFreeWordsInCurrent);
+        pthread_mutex_lock(&h->pageLock);
+        page = allocatepage(1, b, atomic);
+        pthread_mutex_unlock(&h->pageLock);
+        if (!atomic) {
+            w->scan = b->firstFreeWordInPage;
+            grey_pages(page, 1);
+        }
+    }
+    cp = b->firstFreeWordInPage;
+    b->firstFreeWordInPage = cp + words;
+    b->numFreeWordsInCurrent = b->numFreeWordsInCurrent - words;
+    return (cp);
+}
+
+/* A large object is marked by the following function. The worker which
+marks it sweeps the whole object, so its cards are cleaned.
+*/
+void mark_large(LARGE *lo) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    int s = __atomic_load_n(&lo->space, __ATOMIC_ACQUIRE); /* Space number of the object */
+
+    if (s == h->next_space ||
+        !__atomic_compare_exchange_n(&lo->space, &s, h->next_space, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+    memset(lo->cards, 0, lo->numOfCards);
+    if (h->incrementalCycle && lo->pointers != 0) lo->grey = 1;
+    push_grey(thisWorker, &HEADER((char *) lo + GC_LARGEBYTES));
+}
+
+/* The next page of a class buffer is taken by the following function. */
+void next_class_page(CLASSBUFFER *b, int c) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    b->free = PAGE_to_GCP(h, b->nextPage);
+    b->end = b->free + PAGEBYTES(h) / sizeof(GCWORD) / classCells[c] * classCells[c];
+    b->nextPage = b->nextPage + 1;
+    b->pagesLeft = b->pagesLeft - 1;
+}
+
+/* A class buffer of up to n pages for objects of size class c is
+allocated by the following function, which returns 0 when allocatepage
+collected instead. The pages are cleared, so the pointer cells of their
+objects are NULL from the start and their free slots can be swept like
+objects. The caller must hold gcLock, or pageLock during collection.
+*/
+int class_pages(CLASSBUFFER *b, int c, intptr_t n) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCTHREAD run; /* Pages allocated */
+    intptr_t first, /* First page allocated */
+            page; /* Page being tagged */
+
+    first = allocatepage(n, &run, classPtrs[c] == 0);
+    if (first == 0) return (0);
+    n = run.pagesLeftInBuffer + 1;
+    for (page = first; page < first + n; page++) h->classMapping[page] = c;
+    memset(PAGE_to_GCP(h, first), 0, n * PAGEBYTES(h));
+    memset(&h->forwardBits[(first - h->firstheappage) * FORWARDWORDS(h)], 0, n * FORWARDWORDS(h) * sizeof(uint64_t));
+    b->nextPage = first;
+    b->pagesLeft = n;
+    next_class_page(b, c);
+    return (1);
+}
+
+/* An object on a class page is moved by the following function. It has no
+header, so it is forwarded through two bits of forwardBits: the worker
+which sets the first one copies the object, leaves the forwarding pointer
+in its first cell and then sets the second one. The other workers wait for
+the second bit. A single worker sets both bits at once.
+*/
+GCP move_class(GCP cp, int c) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uintptr_t i = ((uintptr_t) cp - (uintptr_t) PAGE_to_GCP(h, h->firstheappage)) / sizeof(GCWORD) * 2;
+    /* Bit # of the claimed bit */
+    uint64_t *bits = &h->forwardBits[i >> 6], /* Word holding the bits */
+            claimed = (uint64_t) 1 << (i & 63), /* Claimed bit */
+            old; /* Bits before they were claimed */
+    GCWORKER *w = thisWorker; /* Worker making the copy */
+    CLASSBUFFER *b = &w->copy.classes[c]; /* Copy buffer for the class */
+    intptr_t cells = classCells[c], /* # of cells in the object */
+            k; /* Cell index */
+    GCP np; /* Pointer to the new object */
+
+    old = __atomic_load_n(bits, __ATOMIC_ACQUIRE);
+    if ((old & claimed) == 0 && h->numOfWorkers > 1) old = __atomic_fetch_or(bits, claimed, __ATOMIC_ACQ_REL);
+    if (old & claimed) {
+        while ((__atomic_load_n(bits, __ATOMIC_ACQUIRE) & claimed << 1) == 0) sched_yield();
+        return ((GCP) cp[0]);
+    }
+    if (b->end - b->free < cells) {
+        if (b->scan != b->free)
+            push_grey(w, (GCHEADER *) b->scan);
+        else if (h->incrementalCycle && b->free != NULL)
+            CLEAR_PAGE_BIT(h, h->greyPages, GCP_to_PAGE(h, b->free - 1));
+        pthread_mutex_lock(&h->pageLock);
+        class_pages(b, c, 1);
+        pthread_mutex_unlock(&h->pageLock);
+        b->scan = b->free;
+        if (classPtrs[c] != 0) grey_pages(GCP_to_PAGE(h, b->free), 1);
+    }
+    np = b->free;
+    b->free = np + cells;
+    if (classPtrs[c] == 0)
+        b->scan = b->free;
+    else
+        w->unsweptClasses = w->unsweptClasses | 1u << c;
+    for (k = 0; k < cells; k++) np[k] = cp[k];
+    cp[0] = (GCWORD) np;
+    w->copiedObjects = w->copiedObjects + 1;
+    w->copiedBytes = w->copiedBytes + cells * sizeof(GCWORD);
+    if (h->numOfWorkers > 1)
+        __atomic_fetch_or(bits, claimed << 1, __ATOMIC_RELEASE);
+    else
+        *bits = *bits | claimed | claimed << 1;
+    return (np);
+}
+
+/* The copies which a worker made of class objects are swept by the
+following function, which returns 0 when there were none to sweep.
+*/
+int sweep_classes(GCWORKER *w) {
+    int c; /* Size class */
+    CLASSBUFFER *b; /* Copy buffer for the class */
+    GCP cp; /* Object being swept */
+
+    if (w->unsweptClasses == 0) return (0);
+    while (w->unsweptClasses != 0) {
+        c = __builtin_ctz(w->unsweptClasses);
+        w->unsweptClasses = w->unsweptClasses & ~(1u << c);
+        b = &w->copy.classes[c];
+        while (b->scan != b->free) {
+            cp = b->scan;
+            b->scan = cp + classCells[c];
+            sweep_cells(cp, classPtrs[c], 1);
+        }
+    }
+    return (1);
+}
+
+/* The class buffers of a thread or worker are given up by the following
+function. The free slots left on their pages are already clear.
+*/
+void release_classes(GCTHREAD *t) {
+    memset(t->classes, 0, sizeof(t->classes));
+}
+
+/* A pointer is moved by the following function. Workers race to forward
+an object: each copies it, and the one which installs its forwarding
+pointer in the old header wins. The others give their copy back.
+*/
+GCP move(GCP cp)
+/* cp:  Pointer to an object */
+{
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t words; /* # of words in the object */
+    GCHEADER header; /* Object header */
+    GCP np; /* Pointer to the new object */
+    GCHEADER *to; /* Space for the copy */
+    GCWORKER *w = thisWorker; /* Worker making the copy */
+    GCTHREAD *b; /* Buffer the copy came from */
+
+    /* If NULL, or points to next space, then ok */
+    if (cp == NULL) return (cp);
+    if (!IN_HEAP(h, cp)) {
+        mark_large(LARGE_of(cp));
+        return (cp);
+    }
+    if (h->space[GCP_to_PAGE(h, cp)] == h->next_space) return (cp);
+    if (h->space[GCP_to_PAGE(h, cp)] == h->pinSpace) {
+        if (MAP_BIT(h->pinBits, MAP_INDEX(h, h->classMapping[GCP_to_PAGE(h, cp)] != 0 ? (GCHEADER *) cp : &HEADER(cp))))
+            return (cp);
+        /* The other objects of a pinned page lie behind its protection */
+        if (h->incrementalCycle) open_pages(GCP_to_PAGE(h, cp));
+    }
+    if (h->classMapping[GCP_to_PAGE(h, cp)] != 0) return (move_class(cp, h->classMapping[GCP_to_PAGE(h, cp)]));
+
+    /* If cell is already forwarded, return forwarding pointer */
+    header = __atomic_load_n(&HEADER(cp), __ATOMIC_ACQUIRE);
+    if (FORWARDED(header)) return (FORWARDING_PTR(h, header));
+
+    /* Forward cell, leave forwarding pointer in old header */
+    words = HEADER_WORDS(header);
+    b = HEADER_PTRS(header) == 0 ? &w->atomic : &w->copy;
+    to = copyalloc(w, words, b == &w->atomic);
+    np = (GCP) (to + 1);
+    *to = header;
+    copy_words(to + 1, &HEADER(cp) + 1, words - 1);
+    if (!__atomic_compare_exchange_n(&HEADER(cp), &header, FORWARD_HEADER(h, np), 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (words > MAXSMALLWORDS(h)) {
+            HEADER(np) = MAKE_HEADER(words, 0);
+        } else {
+            b->firstFreeWordInPage = b->firstFreeWordInPage - words;
+            b->numFreeWordsInCurrent = b->numFreeWordsInCurrent + words;
+        }
+        return (FORWARDING_PTR(h, header));
+    }
+    w->copiedObjects = w->copiedObjects + 1;
+    w->copiedBytes = w->copiedBytes + words * WORDBYTES;
+    if (b == &w->atomic)
+        return (np);
+    if (words > MAXSMALLWORDS(h))
+        push_grey(w, &HEADER(np));
+    else if (h->copyOrder == GC_ORDER_DEPTH && !h->incrementalCycle && w->scan == to && w->numStacked < MAXSTACKED) {
+        /* The copy is swept from the stack instead of by the scan */
+        w->stack[w->numStacked] = to;
+        w->numStacked = w->numStacked + 1;
+        w->scan = to + words;
+    }
+
+    return (np);
+}
+
+/* The starts of the objects on a page which is being pinned are found by
+the following function, which walks the headers from the start of the
+page. No object on the page has been moved yet.
+*/
+void map_starts(intptr_t page) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCHEADER *first = (GCHEADER *) PAGE_to_GCP(h, page), /* Start of the page */
+            *cp; /* Object being mapped */
+    uintptr_t i; /* Bit index of the object */
+
+    memset(&h->startBits[MAP_INDEX(h, first) >> 6], 0, PAGEWORDS(h) / 8);
+    for (cp = first; cp < first + PAGEWORDS(h); cp = cp + HEADER_WORDS(*cp)) {
+        i = MAP_INDEX(h, cp);
+        h->startBits[i >> 6] |= (uint64_t) 1 << (i & 63);
+    }
+}
+
+/* The object on a pinned page which holds the address p is pinned by the
+following function. On a class page it is found from the size class, and
+otherwise it is the last object which starts at or before p. An address
+which is that of a header, such as the end of an allocation buffer, is no
+pointer gcalloc returned and pins nothing.
+*/
+void pin_object(intptr_t page, GCWORD p) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uintptr_t i = MAP_INDEX(h, p), /* Bit index of the address, then of the object */
+            k; /* Slot or bitmap word index */
+    uint64_t m; /* Object starts up to the address */
+    int c = h->classMapping[page]; /* Size class of the page */
+
+    if (c != 0) {
+        k = (p - (uintptr_t) PAGE_to_GCP(h, page)) / sizeof(GCWORD) / classCells[c];
+        if (k >= PAGEBYTES(h) / sizeof(GCWORD) / classCells[c]) return;
+        i = MAP_INDEX(h, (GCP) PAGE_to_GCP(h, page) + k * classCells[c]);
+    } else {
+        if (MAP_BIT(h->startBits, i)) return;
+        k = i >> 6;
+        m = h->startBits[k] & (~(uint64_t) 0 >> (63 - (i & 63)));
+        while (m == 0) m = h->startBits[--k];
+        i = (k << 6) + 63 - __builtin_clzll(m);
+    }
+    if (MAP_BIT(h->pinBits, i)) return;
+    h->pinBits[i >> 6] |= (uint64_t) 1 << (i & 63);
+    h->gcStats.last.pinnedObjects = h->gcStats.last.pinnedObjects + 1;
+}
+
+/* Pages which might have references in the stack or the registers are
+promoted to the next space by the following function, given a hint p. A
+list of promoted pages is formed through the pageQueue cells for each
+page. A page which holds small objects is pinned, so that only the object
+p points into stays in place. All the pages of a multi-page object are
+promoted together.
+*/
+void promote_page(GCWORD p) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t page = GCP_to_PAGE(h, p); /* Page number */
+    int s; /* Space number of the object's pages */
+
+    if (page < h->firstheappage || page > h->lastheappage || !PAGE_BIT(h, h->usedPages, page)) return;
+    if (h->space[page] == h->pinSpace) {
+        pin_object(page, p);
+        return;
+    }
+    if (h->space[page] == h->next_space ||
+        (h->space[page] != h->current_space && h->space[page] != h->old_space))
+        return;
+    if (h->typeMapping[page] == OBJECT &&
+        (page == h->lastheappage || h->typeMapping[page + 1] != CONTINUED || h->space[page + 1] != h->space[page])) {
+        queue(page);
+        h->gcStats.last.promotedPages = h->gcStats.last.promotedPages + 1;
+        h->space[page] = h->pinSpace;
+        SET_PAGE_BIT(h, h->nextPages, page);
+        h->numOfAllocatedPages = h->numOfAllocatedPages + 1;
+        h->pinnedPages[h->numOfPinnedPages] = page;
+        h->numOfPinnedPages = h->numOfPinnedPages + 1;
+        memset(&h->pinBits[MAP_INDEX(h, PAGE_to_GCP(h, page)) >> 6], 0, PAGEWORDS(h) / 8);
+        if (h->classMapping[page] == 0) map_starts(page);
+        pin_object(page, p);
+        if (!PAGE_BIT(h, h->atomicPages, page)) grey_pages(page, 1);
+        return;
+    }
+    while (h->typeMapping[page] == CONTINUED) page = page - 1;
+    queue(page);
+    s = h->space[page];
+    do {
+        h->space[page] = h->next_space;
+        SET_PAGE_BIT(h, h->nextPages, page);
+        if (!PAGE_BIT(h, h->atomicPages, page)) grey_pages(page, 1);
+        h->numOfAllocatedPages = h->numOfAllocatedPages + 1;
+        h->gcStats.last.promotedPages = h->gcStats.last.promotedPages + 1;
+        page = page + 1;
+    } while (page <= h->lastheappage && h->typeMapping[page] == CONTINUED && h->space[page] == s);
+}
+
+/* The large object whose mapping holds the address p is found by the
+following function, which returns NULL when there is none.
+*/
+LARGE *find_large(GCWORD p) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t low = 0, /* First candidate */
+            high = h->numOfLargeObjects; /* Past the last candidate */
+    intptr_t mid; /* Candidate examined */
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if ((uintptr_t) p < (uintptr_t) h->largeObjects[mid]->base) high = mid;
+        else if ((uintptr_t) p >= (uintptr_t) h->largeObjects[mid]->base + h->largeObjects[mid]->bytes) low = mid + 1;
+        else return (h->largeObjects[mid]);
+    }
+    return (NULL);
+}
+
+/* The next hint on a stack is found by the following functions. Each
+returns the first word from fp up to end whose value is in one of the hint
+ranges, or end when there is none.
+*/
+GCWORD *find_hint_scalar(GCWORD *fp, GCWORD *end) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    for (; fp < end; fp++)
+        if ((uintptr_t) *fp - h->hintStart[0] < h->hintBytes[0] ||
+            (uintptr_t) *fp - h->hintStart[1] < h->hintBytes[1])
+            return (fp);
+    return (end);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+GCWORD *find_hint_avx2(GCWORD *fp, GCWORD *end) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN), /* Flips unsigned to signed order */
+            start0 = _mm256_set1_epi64x((int64_t) h->hintStart[0]),
+            start1 = _mm256_set1_epi64x((int64_t) h->hintStart[1]),
+            bytes0 = _mm256_set1_epi64x((int64_t) (h->hintBytes[0] ^ (uint64_t) INT64_MIN)),
+            bytes1 = _mm256_set1_epi64x((int64_t) (h->hintBytes[1] ^ (uint64_t) INT64_MIN)),
+            words, /* Stack words */
+            in; /* Set for the hints */
+    unsigned mask; /* Bit set for each hint */
+
+    for (; fp + 4 <= end; fp = fp + 4) {
+        words = _mm256_loadu_si256((__m256i *) fp);
+        in = _mm256_or_si256(
+                _mm256_cmpgt_epi64(bytes0, _mm256_xor_si256(_mm256_sub_epi64(words, start0), sign)),
+                _mm256_cmpgt_epi64(bytes1, _mm256_xor_si256(_mm256_sub_epi64(words, start1), sign)));
+        mask = (unsigned) _mm256_movemask_pd(_mm256_castsi256_pd(in));
+        if (mask != 0) return (fp + __builtin_ctz(mask));
+    }
+    return (find_hint_scalar(fp, end));
+}
+#endif
+
+/* The search for hints is chosen in gcinit for the processor. */
+GCWORD *(*find_hint)(GCWORD *fp, GCWORD *end) = find_hint_scalar;
+
+/* The stack of a thread between top and base is examined for pointers by
+the following function. Words which might be pointers are picked out by
+find_hint, and large objects which they reference are marked.
+*/
+void scan_stack(GCWORD *top, GCWORD *base) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCWORD *fp, /* Pointer for checking the stack */
+            *end = base + 1; /* Word past the base */
+    LARGE *lo; /* Large object referenced */
+
+    h->hintStart[0] = (uintptr_t) PAGE_to_GCP(h, h->firstheappage);
+    h->hintBytes[0] = (uintptr_t) h->numOfHeapPages * PAGEBYTES(h);
+    h->hintStart[1] = h->hintBytes[1] = 0;
+    if (h->numOfLargeObjects != 0) {
+        h->hintStart[1] = (uintptr_t) h->largeObjects[0]->base;
+        h->hintBytes[1] = (uintptr_t) h->largeObjects[h->numOfLargeObjects - 1]->base +
+                       h->largeObjects[h->numOfLargeObjects - 1]->bytes - h->hintStart[1];
+    }
+    fp = (GCWORD *) (((uintptr_t) top + STACKINC - 1) & ~(uintptr_t) (STACKINC - 1));
+    if (fp < end) h->gcStats.last.stackWords = h->gcStats.last.stackWords + (end - fp);
+    for (fp = find_hint(fp, end); fp < end; fp = find_hint(fp + 1, end)) {
+        if (IN_HEAP(h, *fp))
+            promote_page(*fp);
+        else if ((lo = find_large(*fp)) != NULL)
+            mark_large(lo);
+    }
+}
+
+/* The allocation buffer of a thread is given up by the following function.
+The rest of the current page and any unused pages of the buffer are filled
+with free objects so that every page can be swept.
+*/
+void release_buffer(GCTHREAD *t) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    fill_words(t->firstFreeWordInPage, t->numFreeWordsInCurrent);
+    t->numFreeWordsInCurrent = 0;
+    t->firstFreeWordInPage = NULL;
+    while (t->pagesLeftInBuffer) {
+        fill_words((GCHEADER *) PAGE_to_GCP(h, t->nextBufferPage), PAGEWORDS(h));
+        t->nextBufferPage = t->nextBufferPage + 1;
+        t->pagesLeftInBuffer = t->pagesLeftInBuffer - 1;
+    }
+}
+
+/* A thread waits for the collector to finish in the following function,
+which must be called with gcLock held. Its registers are saved in regs so
+that the collector will find them on the stack.
+*/
+void stop_thread(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    jmp_buf regs; /* Register contents */
+
+    setjmp(regs);
+#ifdef __GNUC__
+    __builtin_unwind_init();
+#endif
+    thisThread->stacktop = (GCWORD *) regs;
+    h->numOfStoppedThreads = h->numOfStoppedThreads + 1;
+    pthread_cond_signal(&h->gcStopped);
+    while (h->stopRequested) pthread_cond_wait(&h->gcResumed, &h->gcLock);
+    h->numOfStoppedThreads = h->numOfStoppedThreads - 1;
+}
+
+/* The gcLock of the given heap is taken by the following function once no
+collection stops its threads. A thread which works in the heap stops for
+such a collection, any other thread just waits for it to end.
+*/
+void lock_heap(GCHEAP *h) {
+    pthread_mutex_lock(&h->gcLock);
+    if (h == thisHeap && thisThread != NULL)
+        while (h->stopRequested) stop_thread();
+    else
+        while (h->stopRequested) pthread_cond_wait(&h->gcResumed, &h->gcLock);
+}
+
+/* The heap a thread works in is returned by the following function, or the
+heap of gcinit for a thread which works in none.
+*/
+GCHEAP *home_heap(void) {
+    return (thisHeap != NULL ? thisHeap : heaps);
+}
+
+/* The ptrs pointer cells from pp are moved by the following function. When
+prefetch is set, they may be left pending while their objects are
+prefetched.
+*/
+void sweep_cells(GCP pp, intptr_t ptrs, int prefetch) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCWORKER *w = thisWorker; /* Worker sweeping the object */
+    GCWORD *cell; /* Pending cell being moved */
+    GCP np; /* Object pointed to */
+    int step = 1; /* Direction of the sweep */
+
+    /* Depth first, the first pointer is moved last so that it is swept first */
+    if (h->copyOrder == GC_ORDER_DEPTH && ptrs != 0) {
+        pp = pp + ptrs - 1;
+        step = -1;
+    }
+    if (h->prefetchDepth == 0 || !prefetch) {
+        while (ptrs--) {
+            *pp = (GCWORD) move((GCP) *pp);
+            pp = pp + step;
+        }
+        return;
+    }
+    while (ptrs--) {
+        np = (GCP) *pp;
+        if (np != NULL) {
+            __builtin_prefetch(&HEADER(np), 0);
+            if (IN_HEAP(h, np)) __builtin_prefetch(&h->space[GCP_to_PAGE(h, np)], 0);
+            if (w->numPending == h->prefetchDepth) {
+                cell = w->pending[w->firstPending];
+                *cell = (GCWORD) move((GCP) *cell);
+                w->pending[w->firstPending] = pp;
+                w->firstPending = (w->firstPending + 1) % h->prefetchDepth;
+            } else {
+                w->pending[(w->firstPending + w->numPending) % h->prefetchDepth] = pp;
+                w->numPending = w->numPending + 1;
+            }
+        }
+        pp = pp + step;
+    }
+}
+
+/* The constituent items of the object at cp are moved by the following
+function, with prefetching when prefetch is set.
+*/
+void sweep_object(GCHEADER *cp, int prefetch) {
+    sweep_cells((GCP) (cp + 1), HEADER_PTRS(*cp), prefetch);
+}
+
+/* The pointer cells of a large object are swept by the following function. */
+void sweep_large(LARGE *lo, int prefetch) {
+    sweep_cells((GCP) ((char *) lo + GC_LARGEBYTES), lo->pointers, prefetch);
+}
+
+/* The pending pointer cells of a worker are moved by the following
+function.
+*/
+void move_pending(GCWORKER *w) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCWORD *cell; /* Pending cell being moved */
+
+    while (w->numPending != 0) {
+        cell = w->pending[w->firstPending];
+        w->firstPending = (w->firstPending + 1) % h->prefetchDepth;
+        w->numPending = w->numPending - 1;
+        *cell = (GCWORD) move((GCP) *cell);
+    }
+}
+
+/* The pinned objects on a pinned page are swept by the following function.
+The other objects on the page may be moved by other workers meanwhile.
+*/
+void sweep_pinned(intptr_t page, int prefetch) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uintptr_t first = MAP_INDEX(h, PAGE_to_GCP(h, page)), /* Bit index of the page */
+            k; /* Bitmap word index */
+    uint64_t m; /* Pinned objects left in the word */
+    GCHEADER *cp; /* Object being swept */
+    int c = h->classMapping[page]; /* Size class of the page */
+
+    for (k = first >> 6; k < (first + PAGEWORDS(h)) >> 6; k++)
+        for (m = h->pinBits[k]; m != 0; m = m & (m - 1)) {
+            cp = (GCHEADER *) PAGE_to_GCP(h, h->firstheappage) + (k << 6) + __builtin_ctzll(m);
+            if (c != 0)
+                sweep_cells((GCP) cp, classPtrs[c], prefetch);
+            else
+                sweep_object(cp, prefetch);
+        }
+}
+
+/* The objects from cp to the end of its page are swept by the following
+function. A region is never on the worker's current copy page, but
+sweeping stops at its free word all the same, unless the page is full, when
+the free word is the start of the next page and may be the header of an
+object given a run of its own. A region outside the heap
+is a large object. Pages of objects without pointers are skipped, and the
+objects on a class page are found from its size class. Only the pinned
+objects of a pinned page are swept. The cells are prefetched when
+prefetch is set.
+*/
+void sweep_region(GCHEADER *cp, int prefetch) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t page = GCP_to_PAGE(h, cp); /* Page being swept */
+    GCP pp, /* Object on a class page */
+            end; /* End of the objects on the page */
+    int c; /* Size class of the page */
+
+    if (!IN_HEAP(h, cp)) {
+        sweep_large(LARGE_of(cp + 1), prefetch);
+        return;
+    }
+    if (PAGE_BIT(h, h->atomicPages, page)) return;
+    if (h->space[page] == h->pinSpace) {
+        sweep_pinned(page, prefetch);
+        return;
+    }
+    if ((c = h->classMapping[page]) != 0) {
+        end = PAGE_to_GCP(h, page) + PAGEBYTES(h) / sizeof(GCWORD) / classCells[c] * classCells[c];
+        for (pp = (GCP) cp; pp < end; pp = pp + classCells[c]) sweep_cells(pp, classPtrs[c], prefetch);
+        return;
+    }
+    while (GCP_to_PAGE(h, cp) == page &&
+           (cp != thisWorker->copy.firstFreeWordInPage || thisWorker->copy.numFreeWordsInCurrent == 0)) {
+        sweep_object(cp, prefetch);
+        cp = cp + HEADER_WORDS(*cp);
+    }
+}
+
+/* A promoted page is taken from the page queue by the following function,
+which returns NULL when the queue is empty.
+*/
+GCHEADER *next_promoted(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t page = 0; /* Page taken */
+
+    if (PEEK(h->queue_head) == 0) return (NULL);
+    pthread_mutex_lock(&h->pageLock);
+    if (h->queue_head != 0) {
+        page = h->queue_head;
+        __atomic_store_n(&h->queue_head, h->pageQueue[h->queue_head], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&h->pageLock);
+    return (page ? (GCHEADER *) PAGE_to_GCP(h, page) : NULL);
+}
+
+/* A worker looks for a region to steal from the other workers with the
+following function.
+*/
+GCHEADER *steal_grey(GCWORKER *w) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    int i; /* Worker index */
+    GCHEADER *cp; /* Region taken */
+
+    for (i = 1; i < h->numOfWorkers; i++) {
+        cp = pop_grey(&h->workers[(w - h->workers + i) % h->numOfWorkers], 1);
+        if (cp != NULL) return (cp);
+    }
+    return (NULL);
+}
+
+/* The following function tells whether any region is waiting to be swept.
+*/
+int grey_regions(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    int i; /* Worker index */
+
+    if (PEEK(h->queue_head) != 0) return (1);
+    for (i = 0; i < h->numOfWorkers; i++)
+        if (PEEK(h->workers[i].top) != PEEK(h->workers[i].bottom)) return (1);
+    return (0);
+}
+
+/* Each worker sweeps objects with the following function until no worker
+has anything left to sweep. Work is taken first from the worker's own copy
+page, then from its deque, the page queue, and finally the other workers.
+A worker only becomes idle with an empty deque and a fully swept copy
+page, so when every worker is idle the collection is complete.
+*/
+void drain(GCWORKER *w) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCHEADER *cp; /* Object or region being swept */
+
+    for (;;) {
+        while (w->numStacked != 0) {
+            w->numStacked = w->numStacked - 1;
+            sweep_object(w->stack[w->numStacked], 1);
+        }
+        while (w->scan != w->copy.firstFreeWordInPage) {
+            cp = w->scan;
+            w->scan = cp + HEADER_WORDS(*cp);
+            sweep_object(cp, 1);
+        }
+        if (sweep_classes(w)) continue;
+        if (w->numPending != 0 || w->numStacked != 0) {
+            move_pending(w);
+            continue;
+        }
+        if ((cp = pop_grey(w, 0)) != NULL ||
+            (cp = next_promoted()) != NULL ||
+            (cp = steal_grey(w)) != NULL) {
+            sweep_region(cp, 1);
+            continue;
+        }
+        __atomic_add_fetch(&h->idleWorkers, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&h->idleWorkers, __ATOMIC_SEQ_CST) == h->numOfWorkers) return;
+            if (grey_regions()) {
+                __atomic_sub_fetch(&h->idleWorkers, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+/* The grey pages which are not yet protected are protected from the
+program by the following function, a run of pages at a time, and so are
+the large objects still to be swept. First the deque of worker 0, which
+sweeps in the fault handler, is made to hold a region for every page and
+large object, so that it does not have to grow there.
+*/
+void protect_grey(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t i, /* Page # of the run */
+            end, /* Page # past the run */
+            k; /* Bitmap word or large object index */
+    uint64_t w; /* Grey pages left unprotected in the word */
+    LARGE *lo; /* Large object */
+    char *obj; /* Its first word */
+
+    grow_grey(&h->workers[0], h->workers[0].bottom + h->numOfHeapPages + h->numOfLargeObjects);
+    for (i = 0; i < h->numOfHeapPages; i = end) {
+        k = i >> 6;
+        w = h->greyPages[k] & ~h->protectedPages[k] & (~(uint64_t) 0 << (i & 63));
+        if (w == 0) {
+            end = (k + 1) << 6;
+            continue;
+        }
+        i = (k << 6) + __builtin_ctzll(w);
+        for (end = i; end < h->numOfHeapPages && PAGE_BIT(h, h->greyPages, h->firstheappage + end) &&
+                      !PAGE_BIT(h, h->protectedPages, h->firstheappage + end); end++)
+            SET_PAGE_BIT(h, h->protectedPages, h->firstheappage + end);
+        mprotect(PAGE_to_GCP(h, h->firstheappage + i), (end - i) * PAGEBYTES(h), PROT_NONE);
+    }
+    for (k = 0; k < h->numOfLargeObjects; k++) {
+        lo = h->largeObjects[k];
+        if (!lo->grey || lo->guarded) continue;
+        obj = (char *) lo + GC_LARGEBYTES;
+        mprotect(obj, lo->base + lo->bytes - obj, PROT_NONE);
+        lo->guarded = 1;
+    }
+}
+
+/* Every protection is removed at the end of an incremental collection by
+the following function.
+*/
+void open_all(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t i, /* Page # of the run */
+            end, /* Page # past the run */
+            k; /* Bitmap word or large object index */
+    uint64_t w; /* Protected pages in the word */
+
+    for (i = 0; i < h->numOfHeapPages; i = end) {
+        k = i >> 6;
+        w = h->protectedPages[k] & (~(uint64_t) 0 << (i & 63));
+        if (w == 0) {
+            end = (k + 1) << 6;
+            continue;
+        }
+        i = (k << 6) + __builtin_ctzll(w);
+        for (end = i; end < h->numOfHeapPages && PAGE_BIT(h, h->protectedPages, h->firstheappage + end); end++)
+            CLEAR_PAGE_BIT(h, h->protectedPages, h->firstheappage + end);
+        mprotect(PAGE_to_GCP(h, h->firstheappage + i), (end - i) * PAGEBYTES(h), PROT_READ | PROT_WRITE);
+    }
+    for (k = 0; k < h->numOfLargeObjects; k++) {
+        open_large(h->largeObjects[k]);
+        h->largeObjects[k]->grey = 0;
+    }
+    memset(h->greyPages, 0, h->numOfBitmapWords * sizeof(uint64_t));
+}
+
+/* The pages being copied into are opened by the following function at
+the start of a step, so that worker w may sweep and extend them.
+*/
+void open_buffers(GCWORKER *w) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCWORD *p[NUMCLASSES + 1]; /* Next free word of each buffer */
+    int i; /* Buffer index */
+
+    p[0] = (GCWORD *) w->copy.firstFreeWordInPage;
+    for (i = 1; i <= NUMCLASSES; i++) p[i] = w->copy.classes[i].free;
+    for (i = 0; i <= NUMCLASSES; i++) {
+        if (p[i] == NULL) continue;
+        if (IN_HEAP(h, p[i])) open_pages(GCP_to_PAGE(h, p[i]));
+        if (IN_HEAP(h, p[i] - 1)) open_pages(GCP_to_PAGE(h, p[i] - 1));
+    }
+}
+
+/* A region is swept during an incremental collection by the following
+function, which opens it first and then marks its pages as swept.
+*/
+void sweep_grey_region(GCHEADER *cp) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    LARGE *lo; /* Large object */
+
+    if (!IN_HEAP(h, cp)) {
+        lo = LARGE_of(cp + 1);
+        open_large(lo);
+        sweep_large(lo, 1);
+        lo->grey = 0;
+        return;
+    }
+    open_pages(GCP_to_PAGE(h, cp));
+    sweep_region(cp, 1);
+    clear_grey(GCP_to_PAGE(h, cp));
+}
+
+/* A grey page which a thread touched is swept whole by the following
+function, so that it may be opened to the program. Objects copied onto the
+page meanwhile are swept as well, without prefetching, so a page being
+copied into is filled with swept objects, or given up when there are no
+more to copy.
+*/
+void sweep_page(intptr_t page) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCWORKER *w = thisWorker; /* Worker sweeping the page */
+    GCTHREAD *b = &w->copy; /* Its copy buffer */
+    CLASSBUFFER *cb; /* Its class buffer for the page */
+    int c; /* Size class of the page */
+
+    while (h->typeMapping[page] == CONTINUED) page = page - 1;
+    open_pages(page);
+    if (!PAGE_BIT(h, h->greyPages, page)) return;
+    sweep_region((GCHEADER *) PAGE_to_GCP(h, page), 0);
+    if ((c = h->classMapping[page]) != 0) {
+        cb = &b->classes[c];
+        if (cb->free != NULL && GCP_to_PAGE(h, cb->free - 1) == page) cb->end = cb->scan = cb->free;
+    } else if (b->firstFreeWordInPage != NULL && GCP_to_PAGE(h, b->firstFreeWordInPage - 1) == page) {
+        fill_words(b->firstFreeWordInPage, b->numFreeWordsInCurrent);
+        b->numFreeWordsInCurrent = 0;
+        w->scan = b->firstFreeWordInPage;
+    }
+    clear_grey(page);
+}
+
+/* Worker w sweeps a step of an incremental collection with the following
+function, until the clock passes deadline, or to the end when deadline is
+0. The clock is read every STEPOBJECTS objects, so a step may run over by
+the time of a few objects, or of a page. It returns 1 when nothing is left
+to sweep. Copies are swept in the order they were made.
+*/
+#define STEPOBJECTS 64
+int drain_step(GCWORKER *w, uint64_t deadline) {
+    GCHEADER *cp; /* Object or region being swept */
+    intptr_t n = 0; /* # of objects and regions swept */
+
+    for (;; n++) {
+        if (deadline != 0 && n % STEPOBJECTS == STEPOBJECTS - 1 && clock_nanos() >= deadline) {
+            move_pending(w);
+            return (0);
+        }
+        if (w->scan != w->copy.firstFreeWordInPage) {
+            cp = w->scan;
+            w->scan = cp + HEADER_WORDS(*cp);
+            sweep_object(cp, 1);
+            continue;
+        }
+        if (sweep_classes(w)) continue;
+        if (w->numPending != 0) {
+            move_pending(w);
+            continue;
+        }
+        if ((cp = pop_grey(w, 0)) != NULL || (cp = next_promoted()) != NULL) {
+            sweep_grey_region(cp);
+            continue;
+        }
+        return (1);
+    }
+}
+
+/* A helper worker runs the following function on its own thread. It
+sweeps once for every collection which uses it.
+*/
+void *worker_thread(void *arg) {
+    GCHEAP *h = ((GCWORKER *) arg)->heap; /* Heap the worker collects */
+    unsigned generation = 0; /* Last collection swept */
+
+    thisWorker = (GCWORKER *) arg;
+    thisHeap = h;
+    gcCards = &h->cards;
+    pthread_mutex_lock(&h->workLock);
+    for (;;) {
+        while (h->workGeneration == generation) pthread_cond_wait(&h->workStart, &h->workLock);
+        generation = h->workGeneration;
+        if (thisWorker - h->workers >= h->numOfWorkers) continue;
+        pthread_mutex_unlock(&h->workLock);
+        drain(thisWorker);
+        pthread_mutex_lock(&h->workLock);
+        h->numOfBusyWorkers = h->numOfBusyWorkers - 1;
+        if (h->numOfBusyWorkers == 0) pthread_cond_signal(&h->workDone);
+    }
+    return (NULL);
+}
+
+/* The number of collector threads is set by the following function. */
+void gc_set_workers(int n) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    if (n < 1) n = 1;
+    if (n > MAXWORKERS) n = MAXWORKERS;
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    pthread_mutex_lock(&h->workLock);
+    h->numOfWorkers = n;
+    while (h->numOfStartedWorkers < h->numOfWorkers) {
+        pthread_create(&h->workers[h->numOfStartedWorkers].thread, NULL,
+                       worker_thread, &h->workers[h->numOfStartedWorkers]);
+        h->numOfStartedWorkers = h->numOfStartedWorkers + 1;
+    }
+    pthread_mutex_unlock(&h->workLock);
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* The # of pointer cells whose objects are prefetched ahead of moving
+them is set by the following function. 0 moves each cell at once.
+*/
+void gc_set_prefetch(int depth) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    if (depth < 0) depth = 0;
+    if (depth > MAXPREFETCH) depth = MAXPREFETCH;
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    h->prefetchDepth = depth;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* The order in which copies are swept is set by the following function.
+GC_ORDER_BREADTH sweeps each copy page from its start, as Cheney does.
+GC_ORDER_DEPTH sweeps the newest copy first, so that an object's children,
+and its first child's children, are copied next to it.
+*/
+void gc_set_order(int order) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    h->copyOrder = order == GC_ORDER_DEPTH ? GC_ORDER_DEPTH : GC_ORDER_BREADTH;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* A space number which is not in use is chosen by the following function.
+*/
+int new_space(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    int s = h->current_space; /* Candidate space number */
+
+    do {
+        s = (s + 1) & 077777;
+    } while (s == h->current_space || s == h->next_space || s == h->old_space);
+    return (s);
+}
+
+/* A pointer is stored into a heap object by the following function, which
+marks the card holding the pointer cell. GC_WRITE in gc.h does the same
+in line.
+*/
+void gc_write(GCP obj, GCP *slot, GCP value) {
+    GC_WRITE(obj, slot, value);
+}
+
+/* The marked cards are found by the following functions. Each returns the
+index of the first marked card in cards from i up to n, or n when there is
+none. Card tables are aligned and padded with clean cards to a multiple of
+CARDBLOCK, so whole words or vectors of cards may be examined.
+*/
+intptr_t dirty_card_scalar(unsigned char *cards, intptr_t i, intptr_t n) {
+    uint64_t word; /* Eight cards */
+
+    while (i < n && (i & 7) != 0) {
+        if (cards[i]) return (i);
+        i = i + 1;
+    }
+    for (; i < n; i = i + 8) {
+        memcpy(&word, cards + i, sizeof(word));
+        if (word != 0) break;
+    }
+    while (i < n && !cards[i]) i = i + 1;
+    return (i < n ? i : n);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+intptr_t dirty_card_sse2(unsigned char *cards, intptr_t i, intptr_t n) {
+    __m128i zero = _mm_setzero_si128();
+    unsigned mask; /* Bit set for each marked card */
+
+    while (i < n && (i & 15) != 0) {
+        if (cards[i]) return (i);
+        i = i + 1;
+    }
+    for (; i < n; i = i + 16) {
+        mask = (unsigned) _mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_load_si128((__m128i *) (cards + i)), zero)) ^ 0xffff;
+        if (mask != 0) {
+            i = i + __builtin_ctz(mask);
+            break;
+        }
+    }
+    return (i < n ? i : n);
+}
+
+__attribute__((target("avx2")))
+intptr_t dirty_card_avx2(unsigned char *cards, intptr_t i, intptr_t n) {
+    __m256i lo, hi, zero = _mm256_setzero_si256();
+    uint64_t mask; /* Bit set for each marked card */
+
+    while (i < n && (i & (CARDBLOCK - 1)) != 0) {
+        if (cards[i]) return (i);
+        i = i + 1;
+    }
+    for (; i < n; i = i + CARDBLOCK) {
+        lo = _mm256_load_si256((__m256i *) (cards + i));
+        hi = _mm256_load_si256((__m256i *) (cards + i + 32));
+        if (_mm256_testz_si256(_mm256_or_si256(lo, hi), _mm256_or_si256(lo, hi))) continue;
+        mask = (uint64_t) (uint32_t) ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero)) |
+               (uint64_t) (uint32_t) ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero)) << 32;
+        i = i + __builtin_ctzll(mask);
+        break;
+    }
+    return (i < n ? i : n);
+}
+#endif
+
+/* The search for marked cards is chosen in gcinit for the processor. */
+intptr_t (*dirty_card)(unsigned char *cards, intptr_t i, intptr_t n) = dirty_card_scalar;
+
+/* Those of the ptrs pointer cells from pp which lie on marked cards between
+first and last are moved by the following function. The card for an
+address is found in cards by its offset from origin.
+*/
+void sweep_object_cards(GCP pp, intptr_t ptrs, GCP first, GCP last, unsigned char *cards, uintptr_t origin) {
+    GCP end = pp + ptrs; /* End of the pointer cells */
+
+    if (pp < first) pp = first;
+    if (end > last) end = last;
+    for (; pp < end; pp = pp + 1)
+        if (cards[((uintptr_t) pp - origin) >> CARDSHIFT]) *pp = (GCWORD) move((GCP) *pp);
+}
+
+/* The marked cards of an old page are swept by the following function.
+The objects on an OBJECT page are found by walking it from its start, while
+a CONTINUED page holds part of the object at the start of its run. The
+objects on a class page are found from its size class.
+*/
+void sweep_page_cards(intptr_t page) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCP first = PAGE_to_GCP(h, page), /* Start of the page */
+            last = PAGE_to_GCP(h, page + 1); /* End of the page */
+    GCHEADER *cp; /* Object being swept */
+    intptr_t head = page, /* First page of the run */
+            k; /* Pointer index */
+    GCP pp; /* Object on a class page */
+    int c = h->classMapping[page]; /* Size class of the page */
+
+    if (c != 0) {
+        for (pp = first; pp + classCells[c] <= last; pp = pp + classCells[c])
+            for (k = 0; k < classPtrs[c]; k++)
+                if (h->cards.table[(uintptr_t) (pp + k) >> CARDSHIFT]) pp[k] = (GCWORD) move((GCP) pp[k]);
+        return;
+    }
+    while (h->typeMapping[head] == CONTINUED) head = head - 1;
+    if (head != page) {
+        cp = (GCHEADER *) PAGE_to_GCP(h, head) + PAGEPAD;
+        sweep_object_cards((GCP) (cp + 1), HEADER_PTRS(*cp), first, last, h->cards.table, 0);
+        return;
+    }
+    for (cp = (GCHEADER *) first; cp < (GCHEADER *) last; cp = cp + HEADER_WORDS(*cp))
+        sweep_object_cards((GCP) (cp + 1), HEADER_PTRS(*cp), first, last, h->cards.table, 0);
+}
+
+/* The marked cards are swept by the following function during a young
+collection, as old objects on them may point into the nursery. Marks on
+other pages are dropped, and every card is clean afterwards. Old large
+objects are swept on the marked cards of their own card tables.
+*/
+void sweep_cards(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t i = 0, /* Card index */
+            page, /* Page holding the card */
+            k; /* Large object index */
+    LARGE *lo; /* Large object being swept */
+    GCP obj; /* Its first word */
+
+    while ((i = dirty_card(h->cards.table + h->cards.first, i, (intptr_t) h->cards.count)) < (intptr_t) h->cards.count) {
+        page = GCP_to_PAGE(h, (h->cards.first + i) << CARDSHIFT);
+        if (h->space[page] == h->old_space && !PAGE_BIT(h, h->atomicPages, page)) sweep_page_cards(page);
+        memset(h->cards.table + ((uintptr_t) PAGE_to_GCP(h, page) >> CARDSHIFT), 0, CARDSPERPAGE(h));
+        i = (intptr_t) (((uintptr_t) PAGE_to_GCP(h, page + 1) >> CARDSHIFT) - h->cards.first);
+    }
+    for (k = 0; k < h->numOfLargeObjects; k++) {
+        lo = h->largeObjects[k];
+        if (lo->space != h->old_space) continue;
+        obj = (GCP) ((char *) lo + GC_LARGEBYTES);
+        for (i = 0; (i = dirty_card(lo->cards, i, lo->numOfCards)) < lo->numOfCards; i++)
+            sweep_object_cards(obj, lo->pointers, (GCP) ((char *) obj + i * CARDBYTES),
+                               (GCP) ((char *) obj + (i + 1) * CARDBYTES), lo->cards, (uintptr_t) obj);
+        memset(lo->cards, 0, lo->numOfCards);
+    }
+}
+
+/* The large objects which were not marked by a collection are returned to
+the system by the following function.
+*/
+void free_large(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t i, /* Large object index */
+            k = 0; /* # of large objects kept */
+
+    for (i = 0; i < h->numOfLargeObjects; i++) {
+        if (h->largeObjects[i]->space == h->old_space)
+            h->largeObjects[k++] = h->largeObjects[i];
+        else {
+            munmap(h->largeObjects[i]->base, h->largeObjects[i]->bytes);
+            h->gcStats.last.freedLarge = h->gcStats.last.freedLarge + 1;
+        }
+    }
+    h->numOfLargeObjects = k;
+}
+
+
+/* The next run of idle pages which are neither in use nor released is
+found by the following function, from bit i onwards. It returns the bit #
+of the first page of the run, and leaves the bit # past its last page in
+end. It returns -1 when there is none.
+*/
+intptr_t idle_run(intptr_t i, intptr_t *end) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t k = i >> 6; /* Word index */
+    uint64_t w; /* Idle pages in the word */
+
+    if (k >= h->numOfBitmapWords) return (-1);
+    w = h->idlePages[k] & ~h->usedPages[k] & ~h->releasedPages[k] & (~(uint64_t) 0 << (i & 63));
+    while (w == 0) {
+        if (++k >= h->numOfBitmapWords) return (-1);
+        w = h->idlePages[k] & ~h->usedPages[k] & ~h->releasedPages[k];
+    }
+    i = (k << 6) + __builtin_ctzll(w);
+    w = ~(h->idlePages[k] & ~h->usedPages[k] & ~h->releasedPages[k]) & (~(uint64_t) 0 << (i & 63));
+    while (w == 0 && ++k < h->numOfBitmapWords)
+        w = ~(h->idlePages[k] & ~h->usedPages[k] & ~h->releasedPages[k]);
+    *end = k < h->numOfBitmapWords ? (k << 6) + __builtin_ctzll(w) : h->numOfHeapPages;
+    if (*end > h->numOfHeapPages) *end = h->numOfHeapPages;
+    return (i);
+}
+
+/* The memory of the pages which stayed free since the last call is given
+back to the system by the following function, and the pages are marked in
+releasedPages so that allocatepage takes them last. Only whole system
+pages are given back. The caller holds gcLock. From the background thread,
+the pages of each run are marked in use while gcLock is released for the
+madvise call, and the pass stops when a collection is requested.
+*/
+void release_idle(int background) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t i = 0, /* Bit # of the run */
+            end, /* Bit # past the run */
+            first, /* First page given back */
+            last, /* Page past the last page given back */
+            page; /* Page being marked */
+    uintptr_t system = (uintptr_t) sysconf(_SC_PAGESIZE), /* # of bytes in a system page */
+            start, /* Start of the memory given back */
+            stop; /* End of the memory given back */
+    int advice = MADV_DONTNEED; /* Advice given to the system */
+
+#ifdef MADV_FREE
+    if (h->releaseAdvice == GC_RELEASE_FREE) advice = MADV_FREE;
+#endif
+    while (!(background && h->stopRequested) && (i = idle_run(i, &end)) >= 0) {
+        if (background && end - i > RELEASEPAGES(h)) end = i + RELEASEPAGES(h);
+        start = ((uintptr_t) PAGE_to_GCP(h, h->firstheappage + i) + system - 1) & ~(system - 1);
+        stop = (uintptr_t) PAGE_to_GCP(h, h->firstheappage + end) & ~(system - 1);
+        i = end;
+        if (start >= stop) continue;
+        first = GCP_to_PAGE(h, start);
+        last = GCP_to_PAGE(h, stop);
+        if (background) {
+            for (page = first; page < last; page++) {
+                SET_PAGE_BIT(h, h->usedPages, page);
+                SET_PAGE_BIT(h, h->avoidPages, page);
+            }
+            h->releaseBusy = 1;
+            pthread_mutex_unlock(&h->gcLock);
+        }
+        madvise((void *) start, stop - start, advice);
+        if (background) {
+            pthread_mutex_lock(&h->gcLock);
+            for (page = first; page < last; page++) CLEAR_PAGE_BIT(h, h->usedPages, page);
+            h->releaseBusy = 0;
+            pthread_cond_broadcast(&h->releaseDone);
+        }
+        for (page = first; page < last; page++) {
+            SET_PAGE_BIT(h, h->releasedPages, page);
+            SET_PAGE_BIT(h, h->avoidPages, page);
+        }
+        h->numOfReleasedPages = h->numOfReleasedPages + (last - first);
+    }
+    if (!(background && h->stopRequested))
+        for (i = 0; i < h->numOfBitmapWords; i++) h->idlePages[i] = ~h->usedPages[i];
+}
+
+/* The background thread started by gc_set_release gives back idle pages
+every releaseInterval milliseconds.
+*/
+void *release_thread(void *arg) {
+    GCHEAP *h = (GCHEAP *) arg; /* Heap whose pages are given back */
+    struct timespec ts; /* Time of the next release */
+
+    thisHeap = h;
+    pthread_mutex_lock(&h->gcLock);
+    for (;;) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += h->releaseInterval / 1000;
+        ts.tv_nsec += (long) (h->releaseInterval % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        while (h->releaseInterval == 0 || h->releaseAdvice == GC_RELEASE_NONE)
+            pthread_cond_wait(&h->releaseWake, &h->gcLock);
+        if (pthread_cond_timedwait(&h->releaseWake, &h->gcLock, &ts) != 0 && !h->stopRequested &&
+            h->releaseInterval != 0 && h->releaseAdvice != GC_RELEASE_NONE)
+            release_idle(1);
+    }
+    return (NULL);
+}
+
+/* How idle pages are given back to the system is set by the following
+function. A page is idle when it stayed free from one release to the next.
+With an interval of 0, idle pages are given back at the end of each
+collection, and otherwise by a background thread every interval
+milliseconds.
+*/
+void gc_set_release(int advice, unsigned interval_ms) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    h->releaseAdvice = advice;
+    h->releaseInterval = interval_ms;
+    if (interval_ms != 0 && !h->releaseStarted) {
+        if (pthread_create(&h->releaseThread, NULL, release_thread, h) != 0) {
+            fprintf(stderr, "gcinit - Unable to start the release thread\n");
+            exit(1);
+        }
+        pthread_detach(h->releaseThread);
+        h->releaseStarted = 1;
+    }
+    pthread_cond_broadcast(&h->releaseWake);
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* The histogram bucket of a pause of the given # of nanoseconds is found
+by the following function.
+*/
+int pause_bucket(uint64_t nanos) {
+    int e; /* Bit # of the highest bit */
+
+    if (nanos < PAUSESUB) return ((int) nanos);
+    e = 63 - __builtin_clzll(nanos);
+    return ((e - PAUSESUBBITS + 1) * PAUSESUB + (int) (nanos >> (e - PAUSESUBBITS) & (PAUSESUB - 1)));
+}
+
+/* The longest pause which falls in a bucket is found by the following
+function.
+*/
+uint64_t bucket_nanos(int i) {
+    int e = i / PAUSESUB + PAUSESUBBITS - 1; /* Bit # of the highest bit */
+
+    if (i < PAUSESUB) return ((uint64_t) i);
+    return (((uint64_t) (PAUSESUB + i % PAUSESUB) << (e - PAUSESUBBITS)) +
+            ((uint64_t) 1 << (e - PAUSESUBBITS)) - 1);
+}
+
+/* The pause of a collection is recorded by the following function, along
+with the heap size and the bytes which survived it.
+*/
+void record_pause(uint64_t nanos, uint64_t heap_bytes, uint64_t survivor_bytes) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    int i = pause_bucket(nanos); /* Bucket of the pause */
+
+    h->pauseCounts[i] = h->pauseCounts[i] + 1;
+    h->pauseHeapBytes[i] = h->pauseHeapBytes[i] + heap_bytes;
+    h->pauseSurvivorBytes[i] = h->pauseSurvivorBytes[i] + survivor_bytes;
+    h->numOfPauses = h->numOfPauses + 1;
+    if (nanos > h->longestPause) h->longestPause = nanos;
+}
+
+/* The pause below which the given percentage of the recorded pauses fall
+is returned in nanoseconds by the following function, 0 when none was
+recorded. The pause is the longest of its bucket, or the longest pause
+recorded when that is shorter. When pause is not NULL, the pauses of the
+bucket are described there.
+*/
+uint64_t gc_pause_percentile_heap(struct gc_heap *h, double percentile, struct gc_pause *pause) {
+    uint64_t rank, /* # of pauses up to the one wanted */
+            seen = 0, /* # of pauses in the buckets so far */
+            nanos = 0; /* Pause found */
+    int i = 0; /* Bucket index */
+
+    lock_heap(h);
+    if (pause != NULL) memset(pause, 0, sizeof(*pause));
+    if (h->numOfPauses != 0) {
+        if (percentile < 0) percentile = 0;
+        if (percentile > 100) percentile = 100;
+        rank = (uint64_t) (percentile / 100 * h->numOfPauses + 0.5);
+        if (rank == 0) rank = 1;
+        for (i = 0; i < PAUSEBUCKETS - 1; i++) {
+            seen = seen + h->pauseCounts[i];
+            if (seen >= rank) break;
+        }
+        nanos = bucket_nanos(i);
+        if (nanos > h->longestPause) nanos = h->longestPause;
+        if (pause != NULL && h->pauseCounts[i] != 0) {
+            pause->nanos = nanos;
+            pause->count = h->pauseCounts[i];
+            pause->heapBytes = h->pauseHeapBytes[i] / h->pauseCounts[i];
+            pause->survivorBytes = h->pauseSurvivorBytes[i] / h->pauseCounts[i];
+        }
+    }
+    pthread_mutex_unlock(&h->gcLock);
+    return (nanos);
+}
+
+uint64_t gc_pause_percentile(double percentile, struct gc_pause *pause) {
+    return (gc_pause_percentile_heap(home_heap(), percentile, pause));
+}
+
+/* The pauses recorded so far are forgotten by the following function. */
+void gc_reset_pauses_heap(struct gc_heap *h) {
+    lock_heap(h);
+    memset(h->pauseCounts, 0, sizeof(h->pauseCounts));
+    memset(h->pauseHeapBytes, 0, sizeof(h->pauseHeapBytes));
+    memset(h->pauseSurvivorBytes, 0, sizeof(h->pauseSurvivorBytes));
+    h->numOfPauses = 0;
+    h->longestPause = 0;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+void gc_reset_pauses(void) {
+    gc_reset_pauses_heap(home_heap());
+}
+
+/* The monotonic clock is read in nanoseconds by the following function. */
+uint64_t clock_nanos(void) {
+    struct timespec ts; /* Monotonic time */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec);
+}
+
+/* The pinned pages join the next space at the end of a collection by the
+following function. The objects on them which were not pinned have been
+moved or are garbage, so the words between the pinned objects are made
+into free objects, or cleared on a class page, and each page can then be
+swept like any other.
+*/
+void unpin_pages(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t n, /* Pinned page index */
+            page, /* Page being joined */
+            slots, /* # of objects on a class page */
+            k; /* Slot index */
+    uintptr_t first, /* Bit index of the page */
+            i, /* Bit index of an object */
+            j; /* Bitmap word index */
+    uint64_t m; /* Object starts left in the word */
+    GCHEADER *base = (GCHEADER *) PAGE_to_GCP(h, h->firstheappage), /* Word of bit index 0 */
+            *gap; /* Start of the free words, or NULL */
+    int c; /* Size class of the page */
+
+    for (n = 0; n < h->numOfPinnedPages; n++) {
+        page = h->pinnedPages[n];
+        first = MAP_INDEX(h, PAGE_to_GCP(h, page));
+        if ((c = h->classMapping[page]) != 0) {
+            slots = PAGEBYTES(h) / sizeof(GCWORD) / classCells[c];
+            for (k = 0; k < slots; k++)
+                if (!MAP_BIT(h->pinBits, first + k * classCells[c] * PTRWORDS))
+                    memset(PAGE_to_GCP(h, page) + k * classCells[c], 0, classCells[c] * sizeof(GCWORD));
+            memset(&h->forwardBits[(page - h->firstheappage) * FORWARDWORDS(h)], 0, FORWARDWORDS(h) * sizeof(uint64_t));
+        } else {
+            gap = NULL;
+            for (j = first >> 6; j < (first + PAGEWORDS(h)) >> 6; j++)
+                for (m = h->startBits[j]; m != 0; m = m & (m - 1)) {
+                    i = (j << 6) + __builtin_ctzll(m);
+                    if (!MAP_BIT(h->pinBits, i)) {
+                        if (gap == NULL) gap = base + i;
+                    } else if (gap != NULL) {
+                        fill_words(gap, base + i - gap);
+                        gap = NULL;
+                    }
+                }
+            if (gap != NULL) fill_words(gap, base + first + PAGEWORDS(h) - gap);
+        }
+        h->space[page] = h->next_space;
+    }
+    h->numOfPinnedPages = 0;
+}
+
+/* The other threads are stopped by the following function, which is
+called with gcLock held. Worker 0 runs on the calling thread, which need
+not be one of the heap's threads.
+*/
+void stop_world(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    h->stopRequested = 1;
+    while (h->numOfStoppedThreads < h->numOfThreads - (thisThread != NULL))
+        pthread_cond_wait(&h->gcStopped, &h->gcLock);
+    while (h->releaseBusy) pthread_cond_wait(&h->releaseDone, &h->gcLock);
+    thisWorker = &h->workers[0];
+}
+
+/* The other threads are let go by the following function. */
+void resume_world(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    thisWorker = NULL;
+    h->stopRequested = 0;
+    pthread_cond_broadcast(&h->gcResumed);
+}
+
+/* The collector flips to the next space with the following function. The
+allocation buffers are given up, and the objects referenced by the stacks
+and registers, the globals and, in a young collection, the marked cards are
+promoted or copied, to be swept afterwards.
+*/
+void flip(int young) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    jmp_buf regs; /* Register contents */
+    GCWORD *fp; /* Top of the stack */
+    GCROOT *r; /* Range of roots being moved */
+    GCP *cell, /* Root being moved */
+            *end; /* Cell past the range */
+    size_t k; /* Handle index */
+    GCTHREAD *t; /* Thread being examined */
+    volatile uint64_t phase = clock_nanos(); /* Time the current phase started, kept across setjmp */
+
+    /* Allocate current pages on a direct call */
+    for (t = h->threads; t != NULL; t = t->next) {
+        release_buffer(t);
+        release_buffer(t->atomic);
+        release_classes(t);
+    }
+
+    /* Advance space */
+    if (young) {
+        h->next_space = h->old_space;
+        h->numOfAllocatedPages = h->numOfOldPages;
+        memcpy(h->nextPages, h->oldPages, h->numOfBitmapWords * sizeof(uint64_t));
+    } else {
+        h->next_space = new_space();
+        h->numOfAllocatedPages = 0;
+        clear_bitmap(h->nextPages);
+    }
+    h->pinSpace = new_space();
+
+    /* Examine stacks and registers for possible pointers */
+    setjmp(regs);
+#ifdef __GNUC__
+    __builtin_unwind_init();
+#endif
+    fp = (GCWORD *) regs < (GCWORD *) &fp ? (GCWORD *) regs : (GCWORD *) &fp;
+    h->queue_head = 0;
+    for (t = h->threads; t != NULL; t = t->next) {
+        if (t->precise)
+            continue;
+        else if (t == thisThread)
+            scan_stack(fp, t->stackbase);
+        else
+            scan_stack(t->stacktop, t->stackbase);
+    }
+    h->gcStats.last.scanNanos = clock_nanos() - phase;
+
+    /* Move global objects */
+    phase = clock_nanos();
+    for (r = h->roots; r < h->roots + h->numOfRoots; r++)
+        for (cell = r->base, end = r->base + r->count; cell < end; cell++)
+            *cell = move(*cell);
+    for (t = h->threads; t != NULL; t = t->next)
+        if (t->shadow != NULL)
+            for (k = 0; k < t->shadow->count; k++)
+                *t->shadow->slots[k] = move(*t->shadow->slots[k]);
+    h->gcStats.last.globalNanos = clock_nanos() - phase;
+
+    /* Old objects which may point into the nursery are swept in place */
+    if (young) {
+        phase = clock_nanos();
+        sweep_cards();
+        h->gcStats.last.cardNanos = clock_nanos() - phase;
+    }
+}
+
+/* The copies counted by worker w are added to the counters of the
+collection by the following function.
+*/
+void count_copies(GCWORKER *w) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    h->gcStats.last.copiedObjects = h->gcStats.last.copiedObjects + w->copiedObjects;
+    h->gcStats.last.copiedBytes = h->gcStats.last.copiedBytes + w->copiedBytes;
+    w->copiedObjects = 0;
+    w->copiedBytes = 0;
+}
+
+/* A collection with nothing left to sweep is finished by the following
+function. The pinned pages join the next space, which becomes the old
+space, and the large objects which were not marked are freed. The
+allocation pages before the collection started are given in before.
+*/
+void finish_collection(int young, intptr_t before) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    int cnt; /* Space number of the nursery */
+    GCTHREAD *t; /* Thread whose buffers are given up */
+    GCWORKER *w; /* Worker being finished */
+    uint64_t *bits; /* Bitmap being exchanged */
+    intptr_t k; /* Bitmap word index */
+
+    if (h->incrementalCycle) {
+        /* The buffers taken during the collection are given up like any
+        other, so that a nursery starts empty */
+        open_all();
+        for (t = h->threads; t != NULL; t = t->next) {
+            release_buffer(t);
+            release_buffer(t->atomic);
+            release_classes(t);
+        }
+        h->incrementalCycle = 0;
+    }
+    for (w = h->workers; w < h->workers + h->numOfWorkers; w++) {
+        release_buffer(&w->copy);
+        release_buffer(&w->atomic);
+        release_classes(&w->copy);
+        w->scan = NULL;
+        count_copies(w);
+    }
+    unpin_pages();
+
+    /* Finished, the nursery gets a space number unlike any evacuated page */
+    if (h->nurseryPages != 0 && !young) memset(h->cards.table + h->cards.first, 0, h->cards.count);
+    cnt = h->nurseryPages != 0 ? new_space() : h->next_space;
+    h->old_space = h->next_space;
+    h->numOfOldPages = h->numOfAllocatedPages;
+    bits = h->oldPages;
+    h->oldPages = h->nextPages;
+    h->nextPages = bits;
+    memcpy(h->usedPages, h->oldPages, h->numOfBitmapWords * sizeof(uint64_t));
+    for (k = 0; k < h->numOfBitmapWords; k++) h->avoidPages[k] = h->usedPages[k] | h->releasedPages[k];
+    free_large();
+    h->largeBytesYoung = 0;
+    if (!young) {
+        h->largeBytesFull = 0;
+        if (h->numOfAllocatedPages > h->numOfHeapPages * h->survivalTarget)
+            grow_heap((intptr_t) (h->numOfAllocatedPages / h->survivalTarget) + 1);
+    }
+    if (h->releaseAdvice != GC_RELEASE_NONE && h->releaseInterval == 0) release_idle(0);
+    if (before > h->numOfAllocatedPages) h->gcStats.last.freedPages = before - h->numOfAllocatedPages;
+    h->current_space = cnt;
+    h->next_space = h->current_space;
+}
+
+/* A pause which began at start is counted by the following function, and
+the counters of the collection are added to the totals once it is done.
+*/
+void count_pause(uint64_t start, int done) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uint64_t nanos = clock_nanos() - start, /* Length of the pause */
+            *last = (uint64_t *) &h->gcStats.last; /* Counters of the collection */
+    intptr_t k; /* Counter index */
+
+    h->gcStats.last.pauseNanos = h->gcStats.last.pauseNanos + nanos;
+    record_pause(nanos, (uint64_t) h->numOfHeapPages * PAGEBYTES(h),
+                 h->gcStats.last.copiedBytes + h->gcStats.last.promotedPages * PAGEBYTES(h));
+    if (!done) return;
+    for (k = 0; k < (intptr_t) (sizeof(h->gcStats.last) / sizeof(uint64_t)); k++)
+        ((uint64_t *) &h->gcStats.total)[k] = ((uint64_t *) &h->gcStats.total)[k] + last[k];
+}
+
+/* The # of pages in use which starts the next full collection is set by
+the following function once a full collection is done. A pause grows with
+the pages which survive and the time between pauses with the pages
+allocated, so the pages allocated since the last full collection, given by
+before, are scaled to spend overheadTarget of the time collecting. Room is
+left to copy a quarter more than survived, and to copy everything once the
+heap is grown as far as it may be. A full collection is never started
+before half of the heap is in use, and always then when overheadTarget is
+0 or collections are incremental.
+*/
+void set_trigger(intptr_t before) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uint64_t now = clock_nanos(), /* Time the collection ended */
+            pause = h->gcStats.last.pauseNanos, /* Length of its pauses */
+            run = now - h->fullNanos - pause; /* Time since the last one ended */
+    intptr_t allocated = before - h->livePages, /* # of pages allocated meanwhile */
+            high = h->numOfHeapPages - h->numOfAllocatedPages - h->numOfAllocatedPages / 4 -
+                   h->numOfHeapPages / 16; /* Latest trigger */
+    double pages; /* # of pages to allocate before the next one */
+
+    h->livePages = h->numOfAllocatedPages;
+    h->fullNanos = now;
+    h->collectPages = h->numOfHeapPages / 2;
+    if (h->overheadTarget == 0 || h->incrementalNanos != 0 || allocated <= 0 || pause == 0 || run == 0)
+        return;
+    if (high > h->maxHeapPages / 2) high = h->maxHeapPages / 2;
+    pages = (double) allocated * pause * (1 - h->overheadTarget) / (h->overheadTarget * run);
+    if (pages > high - h->livePages) pages = high - h->livePages;
+    if (h->livePages + (intptr_t) pages > h->collectPages) h->collectPages = h->livePages + (intptr_t) pages;
+}
+
+/* A step or fault of an incremental collection which began at start is
+ended by the following function. The collection is finished when nothing
+is left to sweep, or at once when the next space has reached cycleLimit
+pages. Otherwise the pages left to sweep are protected, and the threads
+let go.
+*/
+void end_step(uint64_t start, int done) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    if (!done && h->numOfAllocatedPages >= h->cycleLimit) done = drain_step(thisWorker, 0);
+    if (done)
+        finish_collection(0, h->cycleBefore);
+    else {
+        protect_grey();
+        count_copies(thisWorker);
+    }
+    count_pause(start, done);
+    if (done) set_trigger(h->cycleBefore);
+    resume_world();
+}
+
+/* The stack below the caller is cleared by the following function. The
+frames of a step are left there holding pointers into the heap, and a flip
+which later examines them as part of its own frame would pin dead objects.
+*/
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void clear_stack(void) {
+    GCWORD words[STACKCLEAR]; /* Words cleared */
+    volatile GCWORD *w = words; /* Keeps the stores to them */
+    intptr_t i; /* Word index */
+
+    for (i = 0; i < STACKCLEAR; i++) w[i] = 0;
+}
+
+/* A step of an incremental collection is taken by the following function,
+or the collection is finished when finish is set. Only worker 0 sweeps.
+The caller holds gcLock.
+*/
+void collect_step(int finish) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uint64_t start = clock_nanos(), /* Time the step started */
+            phase; /* Time the sweep started */
+    int done; /* Set when nothing is left to sweep */
+
+    stop_world();
+    phase = clock_nanos();
+    h->gcStats.last.stopNanos = h->gcStats.last.stopNanos + (phase - start);
+    h->gcStats.last.steps = h->gcStats.last.steps + 1;
+    open_buffers(thisWorker);
+    done = drain_step(thisWorker, finish ? 0 : phase + h->incrementalNanos);
+    h->gcStats.last.drainNanos = h->gcStats.last.drainNanos + (clock_nanos() - phase);
+    end_step(start, done);
+    clear_stack();
+}
+
+/* The collector is run by the following function. A young collection
+evacuates the nursery into the old space and uses the old objects on marked
+cards as extra roots. Otherwise the whole heap is evacuated into a new space, which
+becomes the old space. Large objects are marked rather than moved. An
+incremental collection under way is finished instead.
+*/
+void collect_space(int young) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uint64_t start = clock_nanos(), /* Time the collection started */
+            phase; /* Time the current phase started */
+    intptr_t before = h->numOfAllocatedPages; /* # of pages allocated before */
+
+    if (h->incrementalCycle) {
+        collect_step(1);
+        return;
+    }
+    /* Check for out of space during collection */
+    if (h->next_space != h->current_space) {
+        fprintf(stderr, "gcalloc - Out of space during collect\n");
+        exit(1);
+    }
+    memset(&h->gcStats.last, 0, sizeof(h->gcStats.last));
+    h->gcStats.last.collections = 1;
+    h->gcStats.last.youngCollections = young != 0;
+
+    /* Stop the other threads */
+    stop_world();
+    h->gcStats.last.stopNanos = clock_nanos() - start;
+    flip(young);
+
+    /* Sweep across promoted and copied pages with all the workers */
+    phase = clock_nanos();
+    h->idleWorkers = 0;
+    if (h->numOfWorkers > 1) {
+        pthread_mutex_lock(&h->workLock);
+        h->numOfBusyWorkers = h->numOfWorkers - 1;
+        h->workGeneration = h->workGeneration + 1;
+        pthread_cond_broadcast(&h->workStart);
+        pthread_mutex_unlock(&h->workLock);
+    }
+    drain(thisWorker);
+    if (h->numOfWorkers > 1) {
+        pthread_mutex_lock(&h->workLock);
+        while (h->numOfBusyWorkers != 0) pthread_cond_wait(&h->workDone, &h->workLock);
+        pthread_mutex_unlock(&h->workLock);
+    }
+    h->gcStats.last.drainNanos = clock_nanos() - phase;
+    finish_collection(young, before);
+    count_pause(start, 1);
+    if (!young) set_trigger(before);
+    resume_world();
+}
+
+/* An incremental collection is started by the following function, which
+is called with gcLock held. The threads are stopped for the flip only, and
+let go with the pages left to sweep protected. The collection is finished
+at once if the next space reaches cycleLimit pages first, which leaves room
+for the objects still to be copied.
+*/
+void start_cycle(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uint64_t start = clock_nanos(); /* Time the collection started */
+
+    memset(&h->gcStats.last, 0, sizeof(h->gcStats.last));
+    h->gcStats.last.collections = 1;
+    h->cycleBefore = h->numOfAllocatedPages;
+    stop_world();
+    h->gcStats.last.stopNanos = clock_nanos() - start;
+    h->incrementalCycle = 1;
+    flip(0);
+    h->cycleLimit = h->numOfHeapPages - 2 * h->cycleBefore - h->numOfHeapPages / 16;
+    protect_grey();
+    count_copies(thisWorker);
+    count_pause(start, 0);
+    resume_world();
+}
+
+/* A fault at the address p is resolved by the following function, which
+returns 0 when the collector did not cause it. A protected page or large
+object with nothing left to sweep is opened at once. Otherwise the other
+threads are stopped while it is swept, with the objects it points to
+copied onto pages which are protected in turn.
+*/
+int resolve_fault(GCWORD p) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t page; /* Page touched */
+    LARGE *lo = NULL; /* Large object touched */
+    uint64_t start = clock_nanos(); /* Time the fault was taken */
+    int precise; /* Set when the thread's stack is not examined */
+
+    if (thisThread == NULL) return (0);
+    page = GCP_to_PAGE(h, p);
+    pthread_mutex_lock(&h->gcLock);
+    /* A precise thread may fault with pointers outside its handles, so its
+    stack is examined should it stop here */
+    precise = thisThread->precise;
+    thisThread->precise = 0;
+    while (h->stopRequested) stop_thread();
+    thisThread->precise = precise;
+    if (!IN_HEAP(h, p) && (lo = find_large(p)) == NULL) {
+        pthread_mutex_unlock(&h->gcLock);
+        return (0);
+    }
+    if (lo == NULL)
+        while (h->typeMapping[page] == CONTINUED) page = page - 1;
+    if (lo != NULL ? !lo->grey : !PAGE_BIT(h, h->greyPages, page)) {
+        if (lo != NULL)
+            open_large(lo);
+        else
+            open_pages(page);
+    } else {
+        stop_world();
+        h->gcStats.last.stopNanos = h->gcStats.last.stopNanos + (clock_nanos() - start);
+        h->gcStats.last.faults = h->gcStats.last.faults + 1;
+        open_buffers(thisWorker);
+        if (lo != NULL) {
+            open_large(lo);
+            sweep_large(lo, 1);
+            move_pending(thisWorker);
+            lo->grey = 0;
+        } else
+            sweep_page(page);
+        end_step(start, 0);
+    }
+    pthread_mutex_unlock(&h->gcLock);
+    return (1);
+}
+
+/* A thread which touches a protected page waits in the following function
+while the page is swept. The fault is raised by the thread's own access to
+the heap, never inside the collector, malloc or a lock, so gcLock may be
+taken here, and the deques and pinnedPages never need malloc. errno is
+kept for the code which faulted. Any other fault is passed to the action
+set before. When that action is the default one or to ignore the fault, the
+default action is restored instead, and the faulting instruction run again
+ends the process.
+*/
+void fault_handler(int sig, siginfo_t *info, void *context) {
+    int saved = errno; /* errno of the faulting code */
+
+    if (!resolve_fault((GCWORD) info->si_addr)) {
+        if (oldFaultAction.sa_flags & SA_SIGINFO)
+            oldFaultAction.sa_sigaction(sig, info, context);
+        else if (oldFaultAction.sa_handler != SIG_DFL && oldFaultAction.sa_handler != SIG_IGN)
+            oldFaultAction.sa_handler(sig);
+        else
+            signal(sig, SIG_DFL);
+    }
+    errno = saved;
+}
+
+/* The longest step of an incremental collection is set in microseconds by
+the following function. 0, the default, collects with the threads stopped
+throughout, and finishes a collection under way. Pages are protected one
+at a time, so they must be at least a system page.
+*/
+void gc_set_incremental(unsigned budget_us) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    long system = sysconf(_SC_PAGESIZE); /* # of bytes in a system page */
+    struct sigaction sa; /* Action for faults */
+
+    if (budget_us != 0 && PAGEBYTES(h) < system) {
+        fprintf(stderr, "gcinit - Incremental collection needs pages of at least %ld bytes\n", system);
+        exit(1);
+    }
+    pthread_mutex_lock(&heapLock);
+    if (budget_us != 0 && !faultHandlerSet) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = fault_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGSEGV, &sa, &oldFaultAction);
+        faultHandlerSet = 1;
+    }
+    pthread_mutex_unlock(&heapLock);
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    if (budget_us == 0 && h->incrementalCycle) collect_step(1);
+    h->incrementalNanos = (uint64_t) budget_us * 1000;
+    if (budget_us != 0) h->collectPages = h->numOfHeapPages / 2;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* The counters of the collector are read by the following functions. */
+void gc_get_stats_heap(struct gc_heap *h, struct gc_stats *stats) {
+    lock_heap(h);
+    *stats = h->gcStats;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+void gc_get_stats(struct gc_stats *stats) {
+    gc_get_stats_heap(home_heap(), stats);
+}
+
+/* The whole heap is collected by the following function. */
+void collect() {
+    collect_space(0);
+}
+
+/* The nursery is collected by the following function. */
+void collect_young() {
+    collect_space(1);
+}
+
+/* When gcalloc is unable to allocate storage, it calls this routine to
+allocate one or more pages. If space is not available then the garbage
+collector will be called and 0 is returned. With a nursery, the nursery
+is collected when it is full and the whole heap is collected when
+collectPages are in use. The heap is grown when a collection leaves too
+little of it free for the request. During a collection the heap is grown
+when it has no free pages left, as far as maxHeapPages allows. A single
+object is given a run of numOfPages pages, tagged OBJECT and then
+CONTINUED. When buffer is not NULL, it is instead given an allocation
+buffer of up to numOfPages OBJECT pages. The pages are marked in atomicPages when atomic is set, as
+they will hold objects without pointers. Free runs are looked for in
+avoidPages from firstFreePage round to the start of the heap, and only then
+among released pages. During an incremental collection, a thread takes a
+step of it before its pages are allocated, and the collection is finished
+instead when the thread has allocated too much meanwhile. The caller must
+hold gcLock, or pageLock during collection.
+*/
+intptr_t allocatepage(intptr_t numOfPages, GCTHREAD *buffer, int atomic) {
+/* # of pages to allocate */
+
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t numOfFreePages = 0, /* # contiguous numOfFreePages pages */
+            firstFreePageIndex = -1, /* Bit # of first free page */
+            page, /* Page being tagged */
+            young, /* # of pages in the nursery */
+            need; /* # of pages in use after a collection and this request */
+    int search = 1; /* Cleared when the heap is too full to search */
+    /* An incremental collection is started when three quarters of the
+    pages which start a full collection are in use, and a thread which
+    allocates while it runs takes a step of it */
+    if (h->current_space != h->next_space && thisWorker == NULL) {
+        collect_step(h->numOfAllocatedPages + numOfPages >= h->cycleLimit);
+        if (h->current_space == h->next_space) return (0);
+    } else if (h->current_space == h->next_space && h->incrementalNanos != 0 &&
+               h->numOfAllocatedPages + numOfPages >= h->collectPages - h->collectPages / 4 &&
+               h->numOfAllocatedPages + numOfPages < h->collectPages)
+        start_cycle();
+    if (h->current_space == h->next_space) {
+        if (buffer && h->numOfAllocatedPages + numOfPages >= h->collectPages)
+            numOfPages = h->collectPages - h->numOfAllocatedPages - 1;
+        if (numOfPages <= 0 || h->numOfAllocatedPages + numOfPages >= h->collectPages) {
+            collect();
+            need = h->numOfAllocatedPages + (buffer ? 1 : numOfPages);
+            if (need >= h->collectPages) grow_heap(2 * need + 2);
+            if (need < h->collectPages) return (0);
+            numOfPages = buffer ? 1 : numOfPages;
+            search = 0;
+        } else if (h->nurseryPages != 0) {
+            young = h->numOfAllocatedPages - h->numOfOldPages;
+            if (buffer && young + numOfPages >= h->nurseryPages) numOfPages = h->nurseryPages - young - 1;
+            if (young != 0 && (numOfPages <= 0 || young + numOfPages >= h->nurseryPages)) {
+                collect_young();
+                return (0);
+            }
+            if (numOfPages <= 0) numOfPages = 1;
+        }
+    }
+    /* Released pages are taken only when no other pages are free */
+    if (search) {
+        firstFreePageIndex = free_run(h->avoidPages, h->firstFreePage - h->firstheappage, numOfPages,
+                                      buffer != NULL, &numOfFreePages);
+        if (firstFreePageIndex < 0 && h->firstFreePage != h->firstheappage)
+            firstFreePageIndex = free_run(h->avoidPages, 0, numOfPages, buffer != NULL, &numOfFreePages);
+        if (firstFreePageIndex < 0 && h->numOfReleasedPages != 0)
+            firstFreePageIndex = free_run(h->usedPages, 0, numOfPages, buffer != NULL, &numOfFreePages);
+        /* A collection which copies more than the free pages grows the heap */
+        if (firstFreePageIndex < 0 && h->current_space != h->next_space && h->numOfHeapPages < h->maxHeapPages) {
+            firstFreePageIndex = h->numOfHeapPages;
+            grow_heap(h->numOfHeapPages + h->numOfHeapPages / 2 + numOfPages);
+            firstFreePageIndex = free_run(h->avoidPages, firstFreePageIndex, numOfPages, buffer != NULL,
+                                          &numOfFreePages);
+        }
+    }
+    if (firstFreePageIndex >= 0) {
+        firstFreePageIndex = firstFreePageIndex + h->firstheappage;
+        h->firstFreePage = firstFreePageIndex + numOfFreePages;
+        if (h->firstFreePage > h->lastheappage) h->firstFreePage = h->firstheappage;
+        h->numOfAllocatedPages = h->numOfAllocatedPages + numOfFreePages;
+        /* Pages copied into must not carry marks left on them while free */
+        if (h->current_space != h->next_space)
+            memset(h->cards.table + ((uintptr_t) PAGE_to_GCP(h, firstFreePageIndex) >> CARDSHIFT), 0,
+                   numOfFreePages * CARDSPERPAGE(h));
+        for (page = firstFreePageIndex; page < firstFreePageIndex + numOfFreePages; page++) {
+            h->space[page] = h->next_space;
+            h->classMapping[page] = 0;
+            SET_PAGE_BIT(h, h->usedPages, page);
+            SET_PAGE_BIT(h, h->avoidPages, page);
+            CLEAR_PAGE_BIT(h, h->idlePages, page);
+            if (atomic)
+                SET_PAGE_BIT(h, h->atomicPages, page);
+            else
+                CLEAR_PAGE_BIT(h, h->atomicPages, page);
+            if (PAGE_BIT(h, h->releasedPages, page)) {
+                CLEAR_PAGE_BIT(h, h->releasedPages, page);
+                h->numOfReleasedPages--;
+            }
+            if (h->current_space != h->next_space) SET_PAGE_BIT(h, h->nextPages, page);
+            h->typeMapping[page] = (buffer || page == firstFreePageIndex) ? OBJECT : CONTINUED;
+            if (PAGEPAD != 0 && h->typeMapping[page] == OBJECT)
+                *(GCHEADER *) PAGE_to_GCP(h, page) = MAKE_HEADER(PAGEPAD, 0);
+        }
+        if (buffer) {
+            buffer->firstFreeWordInPage = (GCHEADER *) PAGE_to_GCP(h, firstFreePageIndex) + PAGEPAD;
+            buffer->numFreeWordsInCurrent = MAXSMALLWORDS(h);
+            buffer->nextBufferPage = firstFreePageIndex + 1;
+            buffer->pagesLeftInBuffer = numOfFreePages - 1;
+        }
+        return (firstFreePageIndex);
+    }
+    fprintf(stderr,
+            "gcalloc - Unable to allocate %ld pages in a %ld page heap\n",
+            (long) numOfPages, (long) h->numOfHeapPages);
+    exit(1);
+}
+
+/* A large object of the given size is allocated by the following function
+in a mapping of its own, whose pointer cells are already zero. Large
+objects count towards starting a collection as if they were in the heap:
+the nursery is collected once they exceed its size, and the whole heap once
+they exceed half of it. An incremental collection is started, or a step
+of a running one taken, as in allocatepage.
+*/
+GCP alloc_large(intptr_t words, int pointers) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t cards, /* # of cards for the object */
+            i; /* Large object index */
+    uintptr_t system = (uintptr_t) sysconf(_SC_PAGESIZE), /* # of bytes in a system page */
+            pad; /* # of bytes before the structure */
+    size_t bytes; /* # of bytes in the mapping */
+    char *base; /* Start of the mapping */
+    LARGE *lo; /* Large object */
+
+    cards = (intptr_t) ((words * WORDBYTES + CARDBYTES - 1) / CARDBYTES);
+    cards = (cards + CARDBLOCK - 1) & ~(intptr_t) (CARDBLOCK - 1);
+    /* The object starts a system page, so that it can be protected apart
+    from its cards and structure */
+    pad = ((cards + GC_LARGEBYTES + system - 1) & ~(system - 1)) - GC_LARGEBYTES;
+    bytes = pad + GC_LARGEBYTES + (words - 1) * WORDBYTES;
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    if (h->current_space != h->next_space)
+        collect_step(0);
+    else if (h->incrementalNanos != 0 &&
+             h->largeBytesFull + bytes > (size_t) ((h->numOfHeapPages / 2 - h->numOfHeapPages / 8) * PAGEBYTES(h)) &&
+             h->largeBytesFull + bytes <= (size_t) (h->numOfHeapPages * PAGEBYTES(h) / 2))
+        start_cycle();
+    if (h->largeBytesFull + bytes > (size_t) (h->numOfHeapPages * PAGEBYTES(h) / 2))
+        collect();
+    else if (h->nurseryPages != 0 && h->largeBytesYoung + bytes > (size_t) (h->nurseryPages * PAGEBYTES(h)))
+        collect_young();
+    base = (char *) mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "gcalloc - Unable to map a large object of %zu bytes\n", bytes);
+        exit(1);
+    }
+    lo = (LARGE *) (base + pad);
+    lo->cards = (unsigned char *) base;
+    lo->base = base;
+    lo->bytes = bytes;
+    lo->numOfCards = cards;
+    lo->pointers = pointers;
+    lo->space = h->next_space;
+    /* The collector reads the size from lo; the header only keeps it if it fits */
+    if ((GCHEADER) words <= HEADER_WORDS_MASK && (GCHEADER) pointers <= HEADER_PTRS_MASK)
+        HEADER((char *) lo + GC_LARGEBYTES) = MAKE_HEADER(words, pointers);
+    else
+        HEADER((char *) lo + GC_LARGEBYTES) = MAKE_HEADER(0, 0);
+    if (h->numOfLargeObjects == h->sizeOfLargeObjects) {
+        h->sizeOfLargeObjects = h->sizeOfLargeObjects ? h->sizeOfLargeObjects * 2 : 64;
+        h->largeObjects = (LARGE **) realloc(h->largeObjects, h->sizeOfLargeObjects * sizeof(LARGE *));
+    }
+    for (i = h->numOfLargeObjects; i > 0 && h->largeObjects[i - 1]->base > base; i--)
+        h->largeObjects[i] = h->largeObjects[i - 1];
+    h->largeObjects[i] = lo;
+    h->numOfLargeObjects = h->numOfLargeObjects + 1;
+    h->largeBytesYoung = h->largeBytesYoung + bytes;
+    h->largeBytesFull = h->largeBytesFull + bytes;
+    pthread_mutex_unlock(&h->gcLock);
+    return ((GCP) ((char *) lo + GC_LARGEBYTES));
+}
+
+/* The size from which objects are large is set by the following function.
+Objects which fit on a page are never large, and a size of 0 keeps every
+object in the heap that its header can describe.
+*/
+void gc_set_large(size_t bytes) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t words = (intptr_t) ((bytes + WORDBYTES - 1) / WORDBYTES + 1); /* # of words in the object */
+
+    if (bytes == 0 || bytes / WORDBYTES >= HEADER_WORDS_MASK) words = HEADER_WORDS_MASK + 1;
+    if (words <= MAXSMALLWORDS(h)) words = MAXSMALLWORDS(h) + 1;
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    h->largeWords = words;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* An object of the given # of cells and pointers is allocated from the
+calling thread's buffer for its size class by the following function.
+*/
+GCP alloc_class(intptr_t cells, int pointers) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    int c = CLASS_OF(cells, pointers); /* Size class */
+    CLASSBUFFER *b = &thisThread->classes[c]; /* Buffer for the class */
+    GCP object; /* Pointer to the object */
+    int got; /* Set once a buffer is allocated */
+
+    if (b->end - b->free < cells) {
+        if (b->pagesLeft != 0) {
+            next_class_page(b, c);
+        } else {
+            pthread_mutex_lock(&h->gcLock);
+            do {
+                while (h->stopRequested) stop_thread();
+                got = class_pages(b, c, h->numOfBufferPages);
+            } while (!got);
+            pthread_mutex_unlock(&h->gcLock);
+        }
+    }
+    object = b->free;
+    b->free = object + cells;
+    return (object);
+}
+
+/* The size up to which objects are allocated by size class, without a
+header, is set by the following function. It is at most MAXCLASSCELLS
+cells, and a size of 0 gives every new object a header.
+*/
+void gc_set_classes(size_t bytes) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t cells, /* # of cells in a class */
+            ptrs; /* # of pointers in a class */
+
+    if (bytes > MAXCLASSCELLS * sizeof(GCWORD)) bytes = MAXCLASSCELLS * sizeof(GCWORD);
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    if (h->forwardBits == NULL) {
+        h->forwardBits = (uint64_t *) map_table(h->numOfReservedPages * FORWARDWORDS(h) * sizeof(uint64_t));
+        for (cells = 1; cells <= MAXCLASSCELLS; cells++)
+            for (ptrs = 0; ptrs <= cells; ptrs++) {
+                classCells[CLASS_OF(cells, ptrs)] = cells;
+                classPtrs[CLASS_OF(cells, ptrs)] = ptrs;
+            }
+    }
+    h->classBytes = bytes;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* A thread announces itself to the collector by calling the following
+function before it allocates any storage. It joins the heap it works in,
+or the heap of gcinit when it works in none.
+*/
+void gc_register_thread(void *stack_base) {
+    GCHEAP *h; /* Heap the thread joins */
+    GCTHREAD *t; /* New thread */
+
+    if (thisHeap == NULL) {
+        thisHeap = heaps;
+        gcCards = &thisHeap->cards;
+    }
+    h = thisHeap;
+    t = (GCTHREAD *) calloc(1, sizeof(GCTHREAD));
+    t->atomic = (GCTHREAD *) calloc(1, sizeof(GCTHREAD));
+    t->stackbase = (GCWORD *) stack_base;
+    t->self = pthread_self();
+    t->shadow = &gcShadow;
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) pthread_cond_wait(&h->gcResumed, &h->gcLock);
+    t->next = h->threads;
+    h->threads = t;
+    h->numOfThreads = h->numOfThreads + 1;
+    thisThread = t;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* A thread withdraws from the collector before it exits by calling the
+following function. Storage it allocated remains valid while it is
+reachable from other threads or the globals. The thread also withdraws
+from the heaps it left, where it counts as stopped.
+*/
+void gc_unregister_thread(void) {
+    GCHEAP *h = thisHeap, /* Heap worked in, then each heap left */
+            *home = h; /* Heap the thread works in */
+    GCTHREAD **tp, /* Link to the calling thread */
+            *t; /* The calling thread in a heap it left */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    release_buffer(thisThread);
+    release_buffer(thisThread->atomic);
+    for (tp = &h->threads; *tp != thisThread; tp = &(*tp)->next);
+    *tp = thisThread->next;
+    h->numOfThreads = h->numOfThreads - 1;
+    pthread_mutex_unlock(&h->gcLock);
+    free(thisThread->atomic);
+    free(thisThread);
+    thisThread = NULL;
+    for (h = heaps; h != NULL; h = __atomic_load_n(&h->next, __ATOMIC_ACQUIRE)) {
+        if (h == home) continue;
+        pthread_mutex_lock(&h->gcLock);
+        while (h->stopRequested) pthread_cond_wait(&h->gcResumed, &h->gcLock);
+        for (tp = &h->threads; *tp != NULL && !pthread_equal((*tp)->self, pthread_self()); tp = &(*tp)->next);
+        t = *tp;
+        if (t != NULL) {
+            *tp = t->next;
+            h->numOfThreads = h->numOfThreads - 1;
+            h->numOfStoppedThreads = h->numOfStoppedThreads - 1;
+        }
+        pthread_mutex_unlock(&h->gcLock);
+        if (t != NULL) {
+            free(t->atomic);
+            free(t);
+        }
+    }
+    free(gcShadow.slots);
+    memset(&gcShadow, 0, sizeof(gcShadow));
+}
+
+/* A thread which runs for a long time without allocating should call the
+following function from time to time, so that it does not hold up a
+collection requested by another thread.
+*/
+void gc_safepoint(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    if (h->stopRequested) {
+        pthread_mutex_lock(&h->gcLock);
+        while (h->stopRequested) stop_thread();
+        pthread_mutex_unlock(&h->gcLock);
+    }
+}
+
+/* A thread which will wait without allocating calls fn(arg) through the
+following function. The thread counts as stopped while fn runs, so fn must
+not touch the heap. The registers are saved in regs so that the collector
+will find them on the stack.
+*/
+void *gc_blocking(void *(*fn)(void *), void *arg) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    jmp_buf regs; /* Register contents */
+    void *result; /* Value returned by fn */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    setjmp(regs);
+#ifdef __GNUC__
+    __builtin_unwind_init();
+#endif
+    thisThread->stacktop = (GCWORD *) regs;
+    h->numOfStoppedThreads = h->numOfStoppedThreads + 1;
+    pthread_cond_signal(&h->gcStopped);
+    pthread_mutex_unlock(&h->gcLock);
+
+    result = fn(arg);
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) pthread_cond_wait(&h->gcResumed, &h->gcLock);
+    h->numOfStoppedThreads = h->numOfStoppedThreads - 1;
+    pthread_mutex_unlock(&h->gcLock);
+    return (result);
+}
+
+/* The shadow stack of the calling thread is given room for more handles
+by the following function, called by GC_HANDLE when it is full.
+*/
+void gc_grow_shadow(void) {
+    size_t size = gcShadow.size ? gcShadow.size * 2 : 256; /* New # of slots */
+    GCP **slots = (GCP **) realloc(gcShadow.slots, size * sizeof(GCP *)); /* New slots */
+
+    if (slots == NULL) {
+        fprintf(stderr, "gcalloc - Unable to allocate the shadow stack\n");
+        exit(1);
+    }
+    gcShadow.slots = slots;
+    gcShadow.size = size;
+}
+
+/* Whether the stack of the calling thread is examined for hints is set by
+the following function. A precise thread keeps its pointers into the heap
+in handles, so that the objects they refer to may all be moved.
+*/
+void gc_set_precise(int precise) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    thisThread->precise = precise;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* The size of the nursery is set by the following function, which must be
+called before any storage is allocated. Pages allocated so far belong to
+the old space from then on.
+*/
+void gc_set_nursery(size_t bytes) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    GCTHREAD *t; /* Thread whose buffer is released */
+    intptr_t i; /* Large object index */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    while (h->releaseBusy) pthread_cond_wait(&h->releaseDone, &h->gcLock);
+    if (h->nurseryPages == 0) {
+        memset(h->cards.table + h->cards.first, 0, h->cards.count);
+        for (i = 0; i < h->numOfLargeObjects; i++) memset(h->largeObjects[i]->cards, 0, h->largeObjects[i]->numOfCards);
+        memcpy(h->oldPages, h->usedPages, h->numOfBitmapWords * sizeof(uint64_t));
+        for (t = h->threads; t != NULL; t = t->next) {
+            release_buffer(t);
+            release_buffer(t->atomic);
+            release_classes(t);
+        }
+        h->numOfOldPages = h->numOfAllocatedPages;
+        h->current_space = new_space();
+        h->next_space = h->current_space;
+    }
+    h->nurseryPages = (intptr_t) (bytes / PAGEBYTES(h));
+    if (h->nurseryPages < 1) h->nurseryPages = 1;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* Address space for the heap is reserved by the following function,
+aligned to a page. Nothing is committed until commit_pages is called. A
+smaller reservation is tried when the system refuses, down to bytes.
+*/
+char *reserve_heap(size_t bytes) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    size_t reserve = HEAPRESERVE < MAXHEAPBYTES ? HEAPRESERVE : MAXHEAPBYTES; /* Size tried */
+    char *heap = MAP_FAILED; /* Start of the reservation */
+
+    if (reserve < bytes) reserve = bytes;
+    while (reserve >= bytes) {
+        heap = (char *) mmap(NULL, reserve + PAGEBYTES(h), PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (heap != MAP_FAILED) break;
+        reserve = reserve / 2;
+    }
+    if (heap == MAP_FAILED) {
+        fprintf(stderr, "gcinit - Unable to reserve a heap of %zu bytes\n", bytes);
+        exit(1);
+    }
+    if ((uintptr_t) heap & (PAGEBYTES(h) - 1)) {
+        heap = heap + (PAGEBYTES(h) - ((uintptr_t) heap & (PAGEBYTES(h) - 1)));
+    }
+    h->numOfReservedPages = (intptr_t) (reserve / PAGEBYTES(h));
+    return (heap);
+}
+
+/* Reserved pages of the heap are made usable by the following function.
+With pages of HUGEPAGEBYTES or more, explicit huge pages are used when the
+system has some reserved, and otherwise transparent huge pages are asked
+for. Huge pages are never partly in use, so a failed attempt to map them
+over the reservation, which may remove it, is followed by an ordinary
+mapping. Smaller pages are committed in whole system pages, which may
+already be partly in use.
+*/
+void commit_pages(intptr_t page, intptr_t n) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    uintptr_t system = (uintptr_t) sysconf(_SC_PAGESIZE); /* # of bytes in a system page */
+    char *start = (char *) ((uintptr_t) PAGE_to_GCP(h, page) & ~(system - 1)); /* First byte to commit */
+    size_t bytes = (((uintptr_t) PAGE_to_GCP(h, page + n) + system - 1) & ~(system - 1)) -
+                   (uintptr_t) start; /* # of bytes to commit */
+
+    if (PAGEBYTES(h) >= HUGEPAGEBYTES) {
+#ifdef MAP_HUGETLB
+        if (mmap(start, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED)
+            return;
+#endif
+        if (mmap(start, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED)
+            start = NULL;
+#ifdef MADV_HUGEPAGE
+        else
+            madvise(start, bytes, MADV_HUGEPAGE);
+#endif
+    } else if (mprotect(start, bytes, PROT_READ | PROT_WRITE) != 0)
+        start = NULL;
+    if (start == NULL) {
+        fprintf(stderr, "gcalloc - Unable to commit %zu bytes of heap\n", bytes);
+        exit(1);
+    }
+}
+
+/* A table with an entry for each reserved page is allocated by the
+following function. Only the entries which are used take memory.
+*/
+void *map_table(size_t bytes) {
+    void *table = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0); /* Zeroed table */
+
+    if (table == MAP_FAILED) {
+        fprintf(stderr, "gcinit - Unable to map a table of %zu bytes\n", bytes);
+        exit(1);
+    }
+    return (table);
+}
+
+/* The bits of a bitmap are changed for a heap grown from old to new pages
+by the following function. The new pages are free, and the bits past them
+are set.
+*/
+void grow_bitmap(uint64_t *bits, intptr_t old, intptr_t new, intptr_t words) {
+    intptr_t i; /* Bit index */
+
+    for (i = old; i < new; i++) bits[i >> 6] &= ~((uint64_t) 1 << (i & 63));
+    for (i = new; i < words * 64; i++) bits[i >> 6] |= (uint64_t) 1 << (i & 63);
+}
+
+/* The heap is grown to the given # of pages, as far as maxHeapPages
+allows, by the following function.
+*/
+void grow_heap(intptr_t pages) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t old = h->numOfHeapPages, /* # of pages before */
+            words; /* # of bitmap words after */
+
+    if (pages > h->maxHeapPages) pages = h->maxHeapPages;
+    if (pages <= old) return;
+    commit_pages(h->firstheappage + old, pages - old);
+    words = (pages + 64 * BITMAPBLOCK - 1) / (64 * BITMAPBLOCK) * BITMAPBLOCK;
+    grow_bitmap(h->usedPages, old, pages, words);
+    grow_bitmap(h->nextPages, old, pages, words);
+    grow_bitmap(h->oldPages, old, pages, words);
+    grow_bitmap(h->releasedPages, old, pages, words);
+    grow_bitmap(h->avoidPages, old, pages, words);
+    grow_bitmap(h->idlePages, old, pages, words);
+    grow_bitmap(h->atomicPages, old, pages, words);
+    h->numOfBitmapWords = words;
+    h->numOfHeapPages = pages;
+    h->lastheappage = h->firstheappage + h->numOfHeapPages - 1;
+    h->cards.count = (uintptr_t) h->numOfHeapPages * CARDSPERPAGE(h);
+    h->numOfBufferPages = h->numOfHeapPages / 64;
+    if (h->numOfBufferPages > BUFFERBYTES / PAGEBYTES(h)) h->numOfBufferPages = BUFFERBYTES / PAGEBYTES(h);
+    if (h->numOfBufferPages < 1) h->numOfBufferPages = 1;
+    if (h->collectPages < h->numOfHeapPages / 2) h->collectPages = h->numOfHeapPages / 2;
+}
+
+/* The largest heap size and the part of it expected to survive a full
+collection are set by the following function. Past that part, the heap is
+grown so that the survivors fill only that part of it.
+*/
+void gc_set_growth(size_t max_bytes, double survival) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    h->maxHeapPages = (intptr_t) (max_bytes / PAGEBYTES(h));
+    if (h->maxHeapPages > h->numOfReservedPages) h->maxHeapPages = h->numOfReservedPages;
+    if (h->maxHeapPages < h->numOfHeapPages) h->maxHeapPages = h->numOfHeapPages;
+    if (survival > 0 && survival < 1) h->survivalTarget = survival;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* The part of the time to spend collecting is set by the following
+function. It takes effect after the next full collection, and 0 starts
+every full collection when half of the heap is in use.
+*/
+void gc_set_overhead(double fraction) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    if (fraction >= 0 && fraction < 1) h->overheadTarget = fraction;
+    if (h->overheadTarget == 0) h->collectPages = h->numOfHeapPages / 2;
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* A range of n root cells from base is added to the roots by the following
+function, which returns its entry. The caller holds gcLock.
+*/
+intptr_t add_root(GCP *base, intptr_t n) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t k; /* Entry of the range */
+
+    if (h->freeRoot >= 0) {
+        k = h->freeRoot;
+        h->freeRoot = h->roots[k].next;
+    } else {
+        if (h->numOfRoots == h->sizeOfRoots) {
+            h->sizeOfRoots = h->sizeOfRoots ? h->sizeOfRoots * 2 : 64;
+            h->roots = (GCROOT *) realloc(h->roots, h->sizeOfRoots * sizeof(GCROOT));
+            if (h->roots == NULL) {
+                fprintf(stderr, "gcalloc - Unable to allocate the root table\n");
+                exit(1);
+            }
+        }
+        k = h->numOfRoots;
+        h->numOfRoots = h->numOfRoots + 1;
+    }
+    h->roots[k].base = base;
+    h->roots[k].count = n;
+    h->roots[k].next = -1;
+    return (k);
+}
+
+/* A pointer cell outside the heap is added to the roots of the heap the
+calling thread works in by the following function. It must hold NULL or a
+pointer to an object of that heap. The root returned is given to
+gc_remove_root.
+*/
+int gc_add_root(GCP *root) {
+    return (gc_add_root_range(root, 1));
+}
+
+/* A range of n pointer cells from base is added to the roots as a single
+entry by the following function, and moved cell by cell at each collection.
+*/
+int gc_add_root_range(GCP *base, size_t n) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t k; /* Entry of the range */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    k = add_root(base, (intptr_t) n);
+    pthread_mutex_unlock(&h->gcLock);
+    return ((int) k);
+}
+
+/* A root added by gc_add_root or gc_add_root_range is taken out of the
+roots by the following function. Its entry is kept for the next root.
+*/
+void gc_remove_root(int root) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    if (root >= 0 && root < h->numOfRoots && h->roots[root].base != NULL) {
+        h->roots[root].base = NULL;
+        h->roots[root].count = 0;
+        h->roots[root].next = h->freeRoot;
+        h->freeRoot = root;
+    }
+    pthread_mutex_unlock(&h->gcLock);
+}
+
+/* A heap with the default settings is made by the following function,
+which adds it to the list of heaps and returns it. The calling thread works
+in it while it is set up, but is not registered yet.
+*/
+GCHEAP *new_heap(void) {
+    GCHEAP *h = (GCHEAP *) calloc(1, sizeof(GCHEAP)); /* New heap */
+    GCHEAP **hp; /* Link to the end of the list */
+
+    if (h == NULL) {
+        fprintf(stderr, "gcinit - Unable to allocate a heap\n");
+        exit(1);
+    }
+    thisHeap = h;
+    gcCards = &h->cards;
+    thisThread = NULL;
+    pthread_mutex_init(&h->gcLock, NULL);
+    pthread_cond_init(&h->gcStopped, NULL);
+    pthread_cond_init(&h->gcResumed, NULL);
+    pthread_cond_init(&h->releaseDone, NULL);
+    pthread_cond_init(&h->releaseWake, NULL);
+    pthread_mutex_init(&h->pageLock, NULL);
+    pthread_mutex_init(&h->workLock, NULL);
+    pthread_cond_init(&h->workStart, NULL);
+    pthread_cond_init(&h->workDone, NULL);
+    h->releaseAdvice = GC_RELEASE_DONTNEED;
+    h->numOfWorkers = 1;
+    h->numOfStartedWorkers = 1;
+    h->prefetchDepth = 8;
+    h->copyOrder = GC_ORDER_BREADTH;
+    pthread_mutex_lock(&heapLock);
+    for (hp = &heaps; *hp != NULL; hp = &(*hp)->next);
+    __atomic_store_n(hp, h, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&heapLock);
+    return (h);
+}
+
+/* The calling thread leaves the heap it works in by calling the following
+function. It stays registered there, counted as stopped and with nothing
+on its stack to examine, so that it can come back.
+*/
+void leave_heap(void) {
+    GCHEAP *h = thisHeap; /* Heap worked in */
+
+    pthread_mutex_lock(&h->gcLock);
+    while (h->stopRequested) stop_thread();
+    release_buffer(thisThread);
+    release_buffer(thisThread->atomic);
+    thisThread->stacktop = thisThread->stackbase;
+    thisThread->shadow = NULL;
+    h->numOfStoppedThreads = h->numOfStoppedThreads + 1;
+    pthread_cond_signal(&h->gcStopped);
+    pthread_mutex_unlock(&h->gcLock);
+    thisThread = NULL;
+}
+
+/* The calling thread starts to work in a heap with the following function.
+A thread which left the heap before takes up its place again, any other
+thread registers with the given stack base.
+*/
+void enter_heap(GCHEAP *h, void *stack_base) {
+    GCTHREAD *t; /* The thread in the heap */
+
+    thisHeap = h;
+    gcCards = &h->cards;
+    pthread_mutex_lock(&h->gcLock);
+    for (t = h->threads; t != NULL && !pthread_equal(t->self, pthread_self()); t = t->next);
+    if (t != NULL) {
+        while (h->stopRequested) pthread_cond_wait(&h->gcResumed, &h->gcLock);
+        h->numOfStoppedThreads = h->numOfStoppedThreads - 1;
+        t->shadow = &gcShadow;
+        thisThread = t;
+    }
+    pthread_mutex_unlock(&h->gcLock);
+    if (t == NULL) gc_register_thread(stack_base);
+}
+
+/* The heap is allocated and the appropriate data structures are initialized
+by the following function, which returns the heap. A calling thread which
+works in no heap registers in the new one, any other stays where it is and
+moves with gc_use_heap. gcinit uses pages of MINPAGEBYTES bytes, while
+gcinit_paged is given the page size.
+*/
+GCHEAP *init_heap(size_t heap_size, size_t page_bytes, void *stack_base, va_list args) {
+    GCHEAP *h, /* New heap */
+            *home = thisHeap; /* Heap the thread works in */
+    GCTHREAD *self = thisThread; /* The calling thread in home */
+    char *heap;
+    intptr_t i;
+    GCP *global_ptr;
+    if (heap_size > MAXHEAPBYTES) {
+        fprintf(stderr, "gcinit - Heap of %zu bytes is too large\n", heap_size);
+        exit(1);
+    }
+    if (page_bytes < MINPAGEBYTES || page_bytes > MAXPAGEBYTES || (page_bytes & (page_bytes - 1)) != 0) {
+        fprintf(stderr, "gcinit - Page size of %zu bytes is not a power of two from %d to %d\n",
+                page_bytes, MINPAGEBYTES, MAXPAGEBYTES);
+        exit(1);
+    }
+    h = new_heap();
+    h->pageBytes = (intptr_t) page_bytes;
+    for (h->pageShift = 0; ((intptr_t) 1 << h->pageShift) < h->pageBytes; h->pageShift++);
+    h->numOfHeapPages = (intptr_t) (heap_size / PAGEBYTES(h));
+    if (h->numOfHeapPages < 2) {
+        fprintf(stderr, "gcinit - Heap of %zu bytes is smaller than two pages\n", heap_size);
+        exit(1);
+    }
+    heap = reserve_heap(h->numOfHeapPages * PAGEBYTES(h));
+    h->maxHeapPages = h->numOfReservedPages;
+    h->survivalTarget = SURVIVAL;
+    h->overheadTarget = OVERHEAD;
+    h->collectPages = h->numOfHeapPages / 2;
+    h->fullNanos = clock_nanos();
+
+    h->firstheappage = GCP_to_PAGE(h, heap);
+    h->lastheappage = h->firstheappage + h->numOfHeapPages - 1;
+    commit_pages(h->firstheappage, h->numOfHeapPages);
+    /* The page tables cover the reservation, and are zero until used */
+    h->space = ((int *) map_table(h->numOfReservedPages * sizeof(int))) - h->firstheappage;
+    h->pageQueue = ((intptr_t *) map_table(h->numOfReservedPages * sizeof(intptr_t))) - h->firstheappage;
+    h->pinnedPages = (intptr_t *) map_table(h->numOfReservedPages * sizeof(intptr_t));
+    h->typeMapping = ((int *) map_table(h->numOfReservedPages * sizeof(int))) - h->firstheappage;
+    h->classMapping = ((int *) map_table(h->numOfReservedPages * sizeof(int))) - h->firstheappage;
+    h->startBits = (uint64_t *) map_table(h->numOfReservedPages * PAGEWORDS(h) / 8);
+    h->pinBits = (uint64_t *) map_table(h->numOfReservedPages * PAGEWORDS(h) / 8);
+    i = (h->numOfReservedPages + 64 * BITMAPBLOCK - 1) / (64 * BITMAPBLOCK) * BITMAPBLOCK;
+    h->usedPages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->nextPages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->oldPages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->releasedPages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->avoidPages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->idlePages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->atomicPages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->greyPages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->protectedPages = (uint64_t *) map_table(i * sizeof(uint64_t));
+    h->numOfBitmapWords = (h->numOfHeapPages + 64 * BITMAPBLOCK - 1) / (64 * BITMAPBLOCK) * BITMAPBLOCK;
+    clear_bitmap(h->usedPages);
+    clear_bitmap(h->nextPages);
+    clear_bitmap(h->oldPages);
+    clear_bitmap(h->releasedPages);
+    clear_bitmap(h->avoidPages);
+    clear_bitmap(h->idlePages);
+    clear_bitmap(h->atomicPages);
+    h->cards.first = (uintptr_t) heap >> CARDSHIFT;
+    h->cards.count = (uintptr_t) h->numOfHeapPages * CARDSPERPAGE(h);
+    h->cards.table = ((unsigned char *) map_table(h->numOfReservedPages * CARDSPERPAGE(h) + CARDBLOCK)) - h->cards.first;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        dirty_card = dirty_card_avx2;
+        find_word = find_word_avx2;
+#if defined(__x86_64__)
+        find_hint = find_hint_avx2;
+#endif
+    } else if (__builtin_cpu_supports("sse2")) dirty_card = dirty_card_sse2;
+#endif
+    h->freeRoot = -1;
+    while ((global_ptr = va_arg(args, GCP *)) != NULL) {
+        *global_ptr = NULL;
+        add_root(global_ptr, 1);
+    }
+    h->current_space = 1;
+    h->next_space = 1;
+    h->old_space = 1;
+    h->firstFreePage = h->firstheappage;
+    h->numOfAllocatedPages = 0;
+    h->queue_head = 0;
+    h->workers = (GCWORKER *) calloc(MAXWORKERS, sizeof(GCWORKER));
+    for (i = 0; i < MAXWORKERS; i++) {
+        pthread_mutex_init(&h->workers[i].lock, NULL);
+        h->workers[i].heap = h;
+    }
+    h->numOfBufferPages = h->numOfHeapPages / 64;
+    if (h->numOfBufferPages > BUFFERBYTES / PAGEBYTES(h)) h->numOfBufferPages = BUFFERBYTES / PAGEBYTES(h);
+    if (h->numOfBufferPages < 1) h->numOfBufferPages = 1;
+    gc_set_large(LARGEBYTES);
+    if (self == NULL) {
+        gc_register_thread(stack_base);
+        return (h);
+    }
+    thisHeap = home;
+    gcCards = &home->cards;
+    thisThread = self;
+    return (h);
+}
+
+void gcinit(size_t heap_size, void *stack_base, ...) {
+    va_list gp; /* Global cells */
+
+    va_start(gp, stack_base);
+    init_heap(heap_size, MINPAGEBYTES, stack_base, gp);
+    va_end(gp);
+}
+
+void gcinit_paged(size_t heap_size, size_t page_bytes, void *stack_base, ...) {
+    va_list gp; /* Global cells */
+
+    va_start(gp, stack_base);
+    init_heap(heap_size, page_bytes, stack_base, gp);
+    va_end(gp);
+}
+
+struct gc_heap *gcinit_heap(size_t heap_size, size_t page_bytes, void *stack_base, ...) {
+    va_list gp; /* Global cells */
+    GCHEAP *heap; /* New heap */
+
+    va_start(gp, stack_base);
+    heap = init_heap(heap_size, page_bytes, stack_base, gp);
+    va_end(gp);
+    return (heap);
+}
+
+/* The calling thread moves to another heap with the following function,
+which returns the heap it worked in before. It must not keep pointers into
+that heap but in its globals and objects, since its stack is no longer
+examined there.
+*/
+struct gc_heap *gc_use_heap(struct gc_heap *heap) {
+    GCHEAP *previous = thisHeap; /* Heap the thread worked in */
+    GCWORD *stack_base; /* Base of the thread's stack */
+
+    if (heap == previous) return (previous);
+    if (thisThread == NULL) {
+        fprintf(stderr, "gcalloc - Thread is not registered\n");
+        exit(1);
+    }
+    stack_base = thisThread->stackbase;
+    leave_heap();
+    enter_heap(heap, stack_base);
+    return (previous);
+}
+
+/* The whole of the given heap is collected by the following function. A
+thread which does not work in the heap collects it from outside, as none
+of the heap's threads: it waits for any collection under way to finish,
+and its own stack is not examined.
+*/
+void gc_collect_heap(struct gc_heap *h) {
+    GCHEAP *home = thisHeap; /* Heap the thread works in */
+    GCTHREAD *self = thisThread; /* The calling thread in home */
+
+    lock_heap(h);
+    if (h != home) {
+        thisHeap = h;
+        gcCards = &h->cards;
+        thisThread = NULL;
+    }
+    collect();
+    pthread_mutex_unlock(&h->gcLock);
+    thisHeap = home;
+    gcCards = home != NULL ? &home->cards : NULL;
+    thisThread = self;
+}
+
+/* Storage is allocated by the following function. It will return a pointer
+to the object. All pointer slots will be initialized to NULL. Objects which
+fit on a page are taken from the calling thread's allocation buffer, larger
+ones are given their own run of pages.
+*/
+GCP gcalloc(size_t bytes, int pointers)
+/* # of bytes in the object */
+/* # of pointers in the object */
+{
+    GCHEAP *h = thisHeap; /* Heap worked in */
+    intptr_t words, /* # of words to allocate */
+            cells, /* # of cells in a class object */
+            i, /* Loop index */
+            page; /* First page of a large object */
+    GCP object; /* Pointer to the object */
+    GCTHREAD *t = pointers == 0 ? thisThread->atomic : thisThread; /* Allocation buffer */
+    // Align the required space to the word size.
+    words = (intptr_t) ((bytes + WORDBYTES - 1) / WORDBYTES + 1);
+    words = (words + PTRWORDS - 1) & ~(intptr_t) (PTRWORDS - 1);
+
+    cells = bytes ? (intptr_t) ((bytes + sizeof(GCWORD) - 1) / sizeof(GCWORD)) : 1;
+    if (h->classBytes != 0 && bytes <= h->classBytes && pointers <= cells) return (alloc_class(cells, pointers));
+    if (words > t->numFreeWordsInCurrent) {
+        if (words >= h->largeWords) return (alloc_large(words, pointers));
+        if ((GCHEADER) words > HEADER_WORDS_MASK || (GCHEADER) pointers > HEADER_PTRS_MASK) {
+            fprintf(stderr, "gcalloc - Object of %zu bytes is too large\n", bytes);
+            exit(1);
+        }
+        if (words > MAXSMALLWORDS(h)) {
+            pthread_mutex_lock(&h->gcLock);
+            do {
+                while (h->stopRequested) stop_thread();
+                page = allocatepage((words + PAGEPAD + PAGEWORDS(h) - 1) / PAGEWORDS(h), NULL,
+                                    pointers == 0);
+            } while (page == 0);
+            pthread_mutex_unlock(&h->gcLock);
+            object = (GCP) ((GCHEADER *) PAGE_to_GCP(h, page) + PAGEPAD + 1);
+            HEADER(object) = MAKE_HEADER(words, pointers);
+            for (i = 0; i < pointers; i++) object[i] = (GCWORD) NULL;
+            return (object);
+        }
+        while (words > t->numFreeWordsInCurrent) {
+            fill_words(t->firstFreeWordInPage, t->numFreeWordsInCurrent);
+            t->numFreeWordsInCurrent = 0;
+            if (t->pagesLeftInBuffer) {
+                t->firstFreeWordInPage = (GCHEADER *) PAGE_to_GCP(h, t->nextBufferPage) + PAGEPAD;
+                t->numFreeWordsInCurrent = MAXSMALLWORDS(h);
+                t->nextBufferPage = t->nextBufferPage + 1;
+                t->pagesLeftInBuffer = t->pagesLeftInBuffer - 1;
+            } else {
+                pthread_mutex_lock(&h->gcLock);
+                while (h->stopRequested) stop_thread();
+                allocatepage(h->numOfBufferPages, t, pointers == 0);
+                pthread_mutex_unlock(&h->gcLock);
+            }
+        }
+    }
+
+    *t->firstFreeWordInPage = MAKE_HEADER(words, pointers);
+    object = (GCP) (t->firstFreeWordInPage + 1);
+    for (i = 0; i < pointers; i++) object[i] = (GCWORD) NULL;
+    t->numFreeWordsInCurrent = t->numFreeWordsInCurrent - words;
+    t->firstFreeWordInPage = t->firstFreeWordInPage + words;
+    return (object);
+}
@@ -0,0 +1,361 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* This module implements garbage collected storage for C programs using the
+"mostly-copying" garbage collection algorithm.
+Copyright (c) 1987, Digitial Equipment Corp.
+The module is initialized by calling:
+gcinit( <heap size>, <stack base>, [ <global>, ... ,] NULL )
+where <heap size> is the size of the heap in bytes, and <stack base> is
+the address of the first word of the stack which could contain a pointer
+to a heap allocated object. Following this are zero or more addresses of
+global cells which will contain pointers to garbage collected objects.
+This list is terminated by NULL. Pointer cells outside the heap may also
+be added to the roots, or taken out, at any time by calling:
+gc_add_root( <address of pointer cell> )
+gc_add_root_range( <address of first cell>, <# of cells> )
+gc_remove_root( <root> )
+where the first two return the root, a small integer which gc_remove_root
+takes. A range, such as a long lived array of pointers, is a single root
+whose cells are moved one after the other at each collection. The cells
+must hold NULL or pointers to objects, and are not cleared when added. The
+globals given to gcinit are roots of one cell each. The heap is managed
+in pages of 512 bytes. Larger pages are used when the module is
+initialized by calling:
+gcinit_paged( <heap size>, <page size>, <stack base>, [ <global>, ... ,] NULL )
+where <page size> is a power of two from 512 bytes to 2 MB. Larger pages
+make the per page tables smaller and ease TLB pressure, at the cost of a
+coarser unit of promotion and allocation. A heap with 2 MB pages is backed
+by explicit huge pages when the system has some reserved, and otherwise by
+transparent huge pages.
+Address space is reserved for the heap to grow into: 64 GB on a 64-bit
+host, or 16 GB with GC_COMPACT_HEADER. Only the pages in use are committed.
+After a full collection, the heap is grown when more than a quarter of it
+survived, so that the survivors fill a quarter of it. It is also grown when
+a collection does not free enough for an allocation. The largest heap size
+and the surviving part are set by calling:
+gc_set_growth( <largest heap size in bytes>, <surviving part> )
+A full collection is started once half of the heap is in use, or later when
+few objects survive. After each one, the pages to allocate before the next
+are chosen from the length of its pause, the time since the one before and
+the pages which survived, so that 5% of the time is spent collecting, while
+room is left to copy the survivors. The part of the time is set by calling:
+gc_set_overhead( <part of the time> )
+where a part of 0 always collects at half of the heap. Incremental
+collections do so as well.
+Once initialized, storage is allocated by calling:
+gcalloc( <bytes>, <pointers> )
+where <bytes> is size of the object in bytes, and <pointers> is the number
+of pointers into the heap which are contained in the object. The pointers
+are expected to be at the start of the object. The function will return a
+pointer to the data structure with its pointer cells initialized to NULL.
+Objects without pointers, such as strings and numeric arrays, are kept on
+pages of their own, which the collector copies or promotes but never
+sweeps. Small objects may be allocated without a header by calling:
+gc_set_classes( <size in bytes> )
+Objects of up to that size, at most four pointer sized cells, are then kept
+on pages which hold one size class, with the same # of cells and pointers.
+The page records the size of its objects, so none of them needs a header.
+A size of 0, the default, gives every object a header.
+For example, an instance of the structure:
+
+ struct symbol {
+    struct *symbol next;
+    char name[10];
+}
+
+could be allocated by:
+    sp = (symbol*)gcalloc( sizeof( symbol ), 1 );
+
+Each thread which allocates storage owns an allocation buffer: a run of
+whole pages obtained from allocatepage(), so that gcalloc() is normally a
+pointer bump in thread local state. A thread other than the one which
+called gcinit() must announce itself before allocating, and withdraw
+before it exits, by calling:
+gc_register_thread( <stack base> )
+gc_unregister_thread()
+A collection stops every registered thread at a safe point. Threads stop
+whenever they need a new allocation buffer, or when they call
+gc_safepoint(). A thread which is about to wait for a long time without
+allocating (for example in pthread_join) should make the call through:
+gc_blocking( <function>, <argument> )
+so that a collection can proceed without it.
+Objects are evacuated by a team of collector threads when the program has
+called:
+gc_set_workers( <number of workers> )
+The thread running the collector is one of them, and gc_set_workers starts
+threads for the others. Each worker copies into its own pages
+and keeps a deque of regions still to be swept, taking regions from the
+other workers when it runs out. While a worker sweeps an object, the
+objects its pointer cells refer to are prefetched some cells ahead of
+being moved. The distance, 8 cells by default and 0 to turn it off, is set
+by calling:
+gc_set_prefetch( <number of cells> )
+Each worker sweeps the objects it copied in the order they were copied,
+breadth first. A program which follows pointers from parents to children,
+first child first, may instead have them copied close together by calling:
+gc_set_order( GC_ORDER_DEPTH )
+just after gcinit. The newest copy is then swept first, which gives an
+approximately depth first order within each copy page.
+A young generation is used when the program has called:
+gc_set_nursery( <nursery size in bytes> )
+before allocating any storage. New objects are then allocated on nursery
+pages, and a young collection only evacuates the nursery: its survivors
+are copied, or promoted with their page, into the old space. Pointers
+stored into the heap must then be stored by calling:
+gc_write( <object>, <address of pointer cell in object>, <pointer> )
+or by the GC_WRITE macro, which does the same in line. Either marks a byte
+in a card table with one entry for every 512 bytes of the heap. The next
+young collection looks for marked cards a vector at a time and sweeps the
+pointer cells of the old objects on them as extra roots. The whole heap is
+collected as it is without a nursery.
+Objects of 64 KB or more are not kept in the heap. Each is given its own
+mapping from the system, is marked in place rather than copied, and its
+mapping is returned when the object dies. The size is changed by calling:
+gc_set_large( <size in bytes> )
+where a size of 0 keeps every object in the heap that its header can
+describe. A large object has a card table of its own for gc_write.
+Free pages which stay unused from one collection to the next are given
+back to the system with madvise, and are the last ones to be allocated
+again. How and when this is done is set by calling:
+gc_set_release( <advice>, <interval in milliseconds> )
+where <advice> is GC_RELEASE_DONTNEED (the default), GC_RELEASE_FREE,
+which lets the system reclaim the pages lazily, or GC_RELEASE_NONE. With
+an interval of 0 the pages are given back at the end of each collection,
+and otherwise by a background thread every interval.
+The threads are stopped for the whole of a full collection unless the
+program has called:
+gc_set_incremental( <longest step in microseconds> )
+A full collection then starts a little earlier, and stops the threads only
+to copy or pin the objects of the stacks, the registers and the globals.
+The rest is swept in steps, each taken by a thread which needs new pages
+and limited to about the given time, and the collection is finished at
+once should the threads allocate too much before it ends. Between steps,
+the pages which may still point into the old space are protected with
+mprotect, so that a thread which touches one waits while it is swept: the
+threads only ever see pointers to copied or pinned objects. Pages must then
+be at least a system page (gcinit_paged with 4096 bytes, say), the threads
+must not let a system call read or write protected objects with pointers,
+which would fail with EFAULT, and a thread which loops without allocating
+should call gc_safepoint() as for any collection. Young collections stop
+the threads as before. A step of 0 turns incremental collection off.
+
+What the collector did is read by calling:
+gc_get_stats( <address of a struct gc_stats> )
+which fills in the counters of the last collection and their totals over
+all collections: the stack words examined, the pages promoted and objects
+pinned by hints, the objects and bytes copied, the heap pages and large
+objects freed, the steps and faults of incremental collections, and the
+time taken by each phase, in nanoseconds of the monotonic clock. The
+counters are kept whether or not they are read.
+The pause of each collection, or of each step and fault of an incremental
+one, is also recorded in a histogram of fixed size, accurate to about 3%.
+The pause below which a percentage of the pauses fall, such as 99.9, is
+returned in nanoseconds by calling:
+gc_pause_percentile( <percentage>, <address of a struct gc_pause or NULL> )
+which also gives, when asked, the mean heap size and surviving bytes of
+the pauses near that one. The pauses recorded are forgotten by calling:
+gc_reset_pauses()
+
+A program may keep several heaps, each with its own pages, threads,
+workers, settings and counters. gcinit makes the first. Another is made by
+calling:
+gcinit_heap( <heap size>, <page size>, <stack base>, [ <global>, ... ,] NULL )
+which returns the heap, a struct gc_heap *, as set up by gcinit_paged. A
+thread works in one heap at a time: gcalloc, GC_WRITE, the roots, the
+settings and the counters all refer to the heap it works in, the new heap
+for a thread which worked in none when it made it, and otherwise the heap
+of gcinit for a thread which calls gc_register_thread. A thread which
+already works in a heap stays there when it makes another. A thread moves
+to another heap by calling:
+gc_use_heap( <heap> )
+which returns the heap it worked in before. A thread which leaves a heap
+must not keep pointers into it but in its globals and objects: it is left
+registered there, but stopped, and its stack is no longer examined. It
+enters a heap for the first time with the stack base it registered with.
+A collection of a heap stops only the threads which work in it, so the
+threads of one heap allocate while another is being collected. A heap is
+collected at once by calling:
+gc_collect_heap( <heap> )
+and its counters and pauses are read and forgotten by calling:
+gc_get_stats_heap( <heap>, <address of a struct gc_stats> )
+gc_pause_percentile_heap( <heap>, <percentage>, <address of a struct gc_pause or NULL> )
+gc_reset_pauses_heap( <heap> )
+from any thread, which need not work in the heap and is not moved there.
+gc_get_stats, gc_pause_percentile and gc_reset_pauses refer to the heap of
+gcinit in a thread which works in none. Only the threads which work in a
+heap may touch its objects while it is collected incrementally.
+
+When the garbage collector is invoked, it will search the processor’s
+registers, the stack, and the global pointers for "hints" as to what
+storage is still accessible. The hints from the registers and stack will
+be used to decide which storage should be left in place. Only the objects
+which the hints point into are left in place: the other objects on their
+pages are relocated or freed as usual, while an object which spans several
+pages keeps all of them. Note that objects which are referenced by global
+pointers might be relocated, in which case the pointer value will be
+modified.
+A local variable may be declared to the collector as a handle, which is
+moved like a global pointer rather than treated as a hint. Handles are kept
+on a shadow stack for each thread, in scopes which follow the blocks of the
+program:
+
+ GCP list, node;
+ GC_OPEN_SCOPE();
+ GC_HANDLE(&list);
+ GC_HANDLE(&node);
+ ...
+ GC_CLOSE_SCOPE();
+
+GC_OPEN_SCOPE declares a variable, so a block has one scope at most, and
+GC_CLOSE_SCOPE drops the handles of the scope; it must be run on each way
+out of the block. A handle must hold NULL or a pointer to an object. A
+thread whose pointers into the heap, on its stack and in its registers,
+all lie in handles, at least whenever it may allocate or stop, may stop
+the collector from examining its stack by calling:
+gc_set_precise( 1 )
+Its objects may then all be moved, so that it must not keep other pointers
+into them, such as a pointer to a cell of an object, over an allocation.
+Calling gc_set_precise( 0 ) makes the thread's stack examined again.
+
+N.B. Heap words, pointer cells, page numbers and the stack scan are all
+pointer sized (GCWORD), so on an LP64 host the heap may be placed anywhere
+in the address space and be larger than 4 GB. Defining GC_COMPACT_HEADER
+keeps the object header at 32 bits on such hosts: the heap is then managed
+in 32-bit words, objects are padded so that their pointer cells stay
+pointer aligned, and a forwarding pointer is stored as a heap offset, which
+limits the heap to 16 GB and an object kept in the heap to 256 KB. Larger
+objects are always large objects, whose size is not kept in the header.
+*/
+
+/* Exported items. */
+typedef intptr_t GCWORD; /* A pointer sized cell in the heap */
+typedef GCWORD *GCP; /* Type definition for a pointer to a garbage
+collected object. */
+extern void gcinit(size_t heap_size, void *stack_base, ...);
+/* <heap size in bytes>, <address of stack base>,
+[ <address of global ptr>, ...] NULL */
+
+extern void gcinit_paged(size_t heap_size, size_t page_bytes, void *stack_base, ...);
+/* <heap size in bytes>, <page size in bytes>, <address of stack base>,
+[ <address of global ptr>, ...] NULL */
+
+extern GCP gcalloc(size_t bytes, int pointers);
+extern int gc_add_root(GCP *root);
+extern int gc_add_root_range(GCP *base, size_t n);
+extern void gc_remove_root(int root);
+extern void gc_set_growth(size_t max_bytes, double survival);
+extern void gc_set_overhead(double fraction);
+extern void gc_register_thread(void *stack_base);
+extern void gc_unregister_thread(void);
+extern void gc_safepoint(void);
+extern void *gc_blocking(void *(*fn)(void *), void *arg);
+extern void gc_set_workers(int workers);
+extern void gc_set_prefetch(int depth);
+extern void gc_set_order(int order);
+extern void gc_set_nursery(size_t bytes);
+extern void gc_write(GCP obj, GCP *slot, GCP value);
+extern void gc_set_large(size_t bytes);
+extern void gc_set_classes(size_t bytes);
+extern void gc_set_release(int advice, unsigned interval_ms);
+extern void gc_set_incremental(unsigned budget_us);
+extern void gc_set_precise(int precise);
+struct gc_heap; /* A heap, made by gcinit_heap */
+extern struct gc_heap *gcinit_heap(size_t heap_size, size_t page_bytes, void *stack_base, ...);
+extern struct gc_heap *gc_use_heap(struct gc_heap *heap);
+extern void gc_collect_heap(struct gc_heap *heap);
+
+/* Counters filled in by gc_get_stats, for one collection or in total. */
+struct gc_counts {
+    uint64_t collections, /* # of collections */
+            youngCollections, /* # of collections of the nursery alone */
+            stackWords, /* # of stack and register words examined */
+            promotedPages, /* # of pages promoted or pinned by hints */
+            pinnedObjects, /* # of objects pinned by hints */
+            copiedObjects, /* # of objects copied */
+            copiedBytes, /* # of bytes copied */
+            freedPages, /* # of heap pages freed */
+            freedLarge, /* # of large objects freed */
+            steps, /* # of steps of an incremental collection */
+            faults, /* # of protected pages swept because a thread touched them */
+            stopNanos, /* Time stopping the other threads */
+            scanNanos, /* Time examining stacks and registers */
+            globalNanos, /* Time moving the objects of global pointers and handles */
+            cardNanos, /* Time sweeping marked cards */
+            drainNanos, /* Time sweeping promoted and copied objects */
+            pauseNanos; /* Time the threads were stopped for the collection */
+};
+struct gc_stats {
+    struct gc_counts last, /* The last collection */
+            total; /* All collections */
+};
+extern void gc_get_stats(struct gc_stats *stats);
+extern void gc_get_stats_heap(struct gc_heap *heap, struct gc_stats *stats);
+
+/* A bucket of the pause histogram, filled in by gc_pause_percentile. */
+struct gc_pause {
+    uint64_t nanos, /* Pause at the percentile */
+            count, /* # of pauses in its bucket */
+            heapBytes, /* Mean heap size at those pauses */
+            survivorBytes; /* Mean # of bytes copied or kept in place by them */
+};
+extern uint64_t gc_pause_percentile(double percentile, struct gc_pause *pause);
+extern uint64_t gc_pause_percentile_heap(struct gc_heap *heap, double percentile, struct gc_pause *pause);
+extern void gc_reset_pauses(void);
+extern void gc_reset_pauses_heap(struct gc_heap *heap);
+
+/* Orders for gc_set_order. */
+#define GC_ORDER_BREADTH 0
+#define GC_ORDER_DEPTH 1
+
+/* Advice for gc_set_release. */
+#define GC_RELEASE_NONE 0
+#define GC_RELEASE_DONTNEED 1
+#define GC_RELEASE_FREE 2
+
+/* The card table used by GC_WRITE, that of the heap the calling thread
+works in. A card covers 1 << CARDSHIFT bytes. */
+#define CARDSHIFT 9
+struct gc_cards {
+    unsigned char *table; /* Mark for each card, indexed by address >> CARDSHIFT */
+    uintptr_t first, /* Card # of first heap card */
+            count; /* # of cards in the heap */
+};
+extern _Thread_local struct gc_cards *gcCards;
+/* The card table of a large object is found through the pointer stored
+GC_LARGEBYTES before the object. */
+#define GC_LARGEBYTES 64
+/* value is evaluated first, since it may allocate and move obj. */
+#define GC_WRITE(obj, slot, value) do { \
+    GCP gc_value = (GCP) (value); /* Pointer being stored */ \
+    GCP gc_obj = (obj); /* Object being stored into */ \
+    GCP *gc_slot = (slot); /* Pointer cell being stored */ \
+    struct gc_cards *gc_cards = gcCards; /* Card table of the heap */ \
+    *gc_slot = gc_value; \
+    if (((uintptr_t) gc_slot >> CARDSHIFT) - gc_cards->first < gc_cards->count) \
+        gc_cards->table[(uintptr_t) gc_slot >> CARDSHIFT] = 1; \
+    else if (gc_obj != NULL && ((uintptr_t) gc_obj >> CARDSHIFT) - gc_cards->first >= gc_cards->count) \
+        (*(unsigned char **) ((char *) gc_obj - GC_LARGEBYTES)) \
+                [((char *) gc_slot - (char *) gc_obj) >> CARDSHIFT] = 1; \
+} while (0)
+
+/* The shadow stack of handles of the calling thread. Its slots hold the
+addresses of the handles, and grow as needed by gc_grow_shadow. */
+struct gc_shadow {
+    GCP **slots; /* Address of each handle */
+    size_t count, /* # of slots in use */
+            size; /* # of slots allocated */
+};
+extern _Thread_local struct gc_shadow gcShadow;
+extern void gc_grow_shadow(void);
+#define GC_OPEN_SCOPE() size_t gc_scope = gcShadow.count /* Slots in use before the scope */
+#define GC_HANDLE(cell) do { \
+    if (gcShadow.count == gcShadow.size) gc_grow_shadow(); \
+    gcShadow.slots[gcShadow.count++] = (cell); \
+} while (0)
+#define GC_CLOSE_SCOPE() (gcShadow.count = gc_scope)
+
+#endif